@@ -1,89 +1,231 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
-#include <set>
-#include <map>
 #include <vector>
+#include <string>
 #include <iterator>
 #include <algorithm>
-#include <numeric>
-#include <cmath>
+#include <optional>
+#include <cstdint>
+#include <cstdlib>
 
-//O(n log n) since the construction of the set is the most expensive operation
-int main(int argc, char *argv[])
+//adapters can be chained when the next one is higher by one of these gaps
+struct AllowedGaps
 {
-    assert(("expect input", argc == 2));
+    //allowed must hold at least one gap and every gap must be positive,
+    //main checks both on the command line
+    explicit AllowedGaps(std::vector<unsigned> allowed) : gaps{std::move(allowed)}
+    {
+        assert(!gaps.empty());
+        std::sort(std::begin(gaps), std::end(gaps));
+        gaps.erase(std::unique(std::begin(gaps), std::end(gaps)), std::end(gaps));
+        assert(gaps.front() > 0);
+        largest = gaps.back();
+    }
 
-    std::ifstream ifs{argv[1]};
+    //O(log number of gaps)
+    bool contains(unsigned gap) const
+    {
+        return std::binary_search(std::cbegin(gaps), std::cend(gaps), gap);
+    }
 
-    //O(n log n) to insert all elements from input
-    std::set<int> adapters{std::istream_iterator<int>{ifs}, std::istream_iterator<int>{}};
+    std::vector<unsigned> gaps;
+    unsigned largest{};
+};
 
-    adapters.insert(0);
+//ranges up to this many times the number of adapters are sorted by counting
+const std::size_t COUNTING_SORT_FACTOR = 8;
 
-    //O(n)
-    const int max_element = *std::max_element(std::cbegin(adapters), std::cend(adapters));
-    adapters.insert(max_element + 3);
+//sorted joltages without duplicates
+//O(n + range) when the range is small enough for a counting sort, O(n log n) otherwise
+std::vector<unsigned> sort_joltages(std::vector<unsigned> joltages)
+{
+    if(joltages.empty())
+        return joltages;
+
+    const auto [lowest, highest] = std::minmax_element(std::cbegin(joltages), std::cend(joltages));
+    const std::size_t first = *lowest;
+    const std::size_t range = *highest - first + 1;
+    if(range > std::max<std::size_t>(joltages.size() * COUNTING_SORT_FACTOR, 1 << 16))
+    {
+        std::sort(std::begin(joltages), std::end(joltages));
+        joltages.erase(std::unique(std::begin(joltages), std::end(joltages)), std::end(joltages));
+        return joltages;
+    }
 
-    std::vector<int> differences;
+    std::vector<bool> present(range, false);
+    for(auto joltage : joltages)
+        present[joltage - first] = true;
 
-    //O(n)
-    std::adjacent_difference(std::cbegin(adapters), std::cend(adapters), std::back_inserter(differences));
+    joltages.clear();
+    for(std::size_t i = 0; i != range; ++i)
+    {
+        if(present[i])
+            joltages.push_back(first + i);
+    }
+    return joltages;
+}
 
-    //O(n)
-    const int number_of_ones = std::count(std::cbegin(differences), std::cend(differences), 1);
-    //O(n)
-    const int number_of_threes = std::count(std::cbegin(differences), std::cend(differences), 3);
+//Unbounded count for catalogues where arrangements do not fit in 128 bits.
+//The DP only adds counts, so addition is all it needs. Limbs are base 10^18
+//from the least significant one, which makes printing trivial.
+class BigCount
+{
+public:
+    BigCount(std::uint64_t value = 0)
+    {
+        do {
+            _limbs.push_back(value % BASE);
+            value /= BASE;
+        } while(value);
+    }
 
-    //part a
-    std::cout << number_of_ones << " " << number_of_threes << '\n';
-    std::cout << "Result " << number_of_ones * number_of_threes << '\n';
+    //O(number of limbs)
+    BigCount &operator+=(BigCount const& other)
+    {
+        if(other._limbs.size() > _limbs.size())
+            _limbs.resize(other._limbs.size(), 0);
+
+        std::uint64_t carry = 0;
+        for(std::size_t i = 0; i != _limbs.size(); ++i)
+        {
+            _limbs[i] += carry + (i < other._limbs.size() ? other._limbs[i] : 0);
+            carry = _limbs[i] >= BASE;
+            if(carry)
+                _limbs[i] -= BASE;
+        }
+        if(carry)
+            _limbs.push_back(carry);
+        return *this;
+    }
 
-    //part b
-    std::map<int, int> consecutive_ones_counter;
-    int ones = 0;
-    for(auto i : differences) {
-        if(i == 1) {
-            ones++;
-        } else if(ones >= 1) {
-            consecutive_ones_counter[ones]++;
-            ones = 0;
+    friend std::string to_string(BigCount const& count)
+    {
+        std::string digits = std::to_string(count._limbs.back());
+        for(std::size_t i = count._limbs.size() - 1; i-- != 0;)
+        {
+            const auto limb = std::to_string(count._limbs[i]);
+            digits.append(18 - limb.size(), '0');
+            digits += limb;
         }
+        return digits;
     }
 
-    //Explanation:
-    //
-    //For example, if we have a list of adapters like this:
-    //
-    //0, 1, 2, 3, 6
-    //
-    //We cannot simply have a combination based on the number of subsets of 1, 2, 3: {1}, {2}, {3}, {1, 2}, {1, 3}, {2, 3}, {1, 2, 3} {} (this is 8 since the number of subsets is 2^number of elements) due to the constraints.
-    //However, {0, 1, 2, 6} is not a valid combination of adapters, since, in the subset {1,2}, the difference between 6 and 2 is 4 jolts and we can only have a difference of 3 jolts at maximum and 1 jolts at minimum. So, the valid subsets would be {3}, {1, 3}, {2, 3}, {1, 2, 3} since they respect the constraints.
+private:
+    static constexpr std::uint64_t BASE = 1000000000000000000ull;
+    std::vector<std::uint64_t> _limbs;
+};
 
-    //So, I realized that the number of combinations depends on the number of consecutive ones. From the example above, the adjacent difference is
-    //1, 1, 1, 3
+using wide_count_t = unsigned __int128;
 
-    //If we have 3 ones in sequence, we have to keep at least one number since 0, 6 is not a valid adapter sequence. That means that we will have only 4 valid adapters combinations instead of 8 without the restriction based on 2^2. If we had 4 consecutive ones, we would look for the number of subsets of a set of size 3. Always number of elements - 1. F
+std::string to_string(wide_count_t count)
+{
+    std::string digits;
+    do {
+        digits += static_cast<char>('0' + static_cast<int>(count % 10));
+        count /= 10;
+    } while(count);
+    return {std::rbegin(digits), std::rend(digits)};
+}
 
-    //So, for each superset, we have to calculate the number of valid subsets.
+//false when the sum does not fit
+bool add_count(wide_count_t &sum, wide_count_t count)
+{
+    return !__builtin_add_overflow(sum, count, &sum);
+}
 
-    //I pre computed values of number of valid subsets since the number of consecutive ones for this problem is 4 at maximum.
-    //I could have computed this using dynamic programming. Creating the superset for each number of consecutives ones found in the adjancet numbers container and searching for the valid subsets using the constraints in the problem description (1, 2, 3 jolts at maximum from the outlet to the device).
+bool add_count(BigCount &sum, BigCount const& count)
+{
+    sum += count;
+    return true;
+}
 
-    std::size_t result = 1;
+//Number of ways to go from the first joltage to the last one, where every
+//step goes up by an allowed gap. The ways to reach an adapter are the sum of
+//the ways to reach every lower adapter an allowed gap away, and since
+//joltages are distinct only the last largest gap adapters can be that close,
+//so they are the only counts kept.
+//Returns nothing when the count does not fit in Count.
+//O(n * min(n, largest gap)) additions
+template<typename Count>
+std::optional<Count> count_arrangements(std::vector<unsigned> const& joltages, AllowedGaps const& gaps)
+{
+    if(joltages.empty())
+        return std::nullopt;
+
+    const std::size_t window = std::min<std::size_t>(gaps.largest + 1, joltages.size());
+    std::vector<Count> ways(window, Count{0});
+    ways[0] = Count{1};
+
+    for(std::size_t i = 1; i != joltages.size(); ++i)
+    {
+        Count sum{0};
+        for(std::size_t j = i; j-- != 0 && joltages[i] - joltages[j] <= gaps.largest;)
+        {
+            if(gaps.contains(joltages[i] - joltages[j]) && !add_count(sum, ways[j % window]))
+                return std::nullopt;
+        }
+        ways[i % window] = std::move(sum);
+    }
 
-    std::map<int, int> combinations = {{0, 1}, {1, 2}, {2, 4}, {3, 7}, {4, 13}};
+    return ways[(joltages.size() - 1) % window];
+}
 
-    //O(n) where n is the size of differences container (which is input size - 1)
-    for(auto i : consecutive_ones_counter) {
-        auto [ones, count] = i;
-        std::cout << ones << " " << count << '\n';
-        if(ones > 1) {
-            result *= std::pow(combinations[ones-1], count);
+//usage: input [gaps...]
+//where gaps are the allowed joltage differences, 1 2 3 by default
+//O(n + range) or O(n log n) to sort, then O(n * min(n, largest gap))
+int main(int argc, char *argv[])
+{
+    assert(("expect input, optionally followed by the allowed gaps", argc >= 2));
+
+    std::vector<unsigned> gap_list;
+    for(int i = 2; i < argc; ++i)
+    {
+        const long gap = std::atol(argv[i]);
+        if(gap <= 0)
+        {
+            std::cerr << "invalid gap " << argv[i] << '\n';
+            return 1;
         }
+        gap_list.push_back(gap);
     }
+    if(gap_list.empty())
+        gap_list = {1, 2, 3};
+    const AllowedGaps gaps{gap_list};
+
+    std::ifstream ifs{argv[1]};
+    std::vector<unsigned> input{std::istream_iterator<unsigned>{ifs}, std::istream_iterator<unsigned>{}};
+
+    //the outlet and the device, which is the largest gap above the highest adapter
+    input.push_back(0);
+    auto joltages = sort_joltages(std::move(input));
+    unsigned device;
+    if(__builtin_add_overflow(joltages.back(), gaps.largest, &device))
+    {
+        std::cerr << "device joltage does not fit\n";
+        return 1;
+    }
+    joltages.push_back(device);
+
+    //O(n)
+    std::size_t number_of_ones = 0;
+    std::size_t number_of_threes = 0;
+    for(std::size_t i = 1; i != joltages.size(); ++i)
+    {
+        const auto difference = joltages[i] - joltages[i - 1];
+        number_of_ones += difference == 1;
+        number_of_threes += difference == 3;
+    }
+
+    //part a
+    std::cout << number_of_ones << " " << number_of_threes << '\n';
+    std::cout << "Result " << number_of_ones * number_of_threes << '\n';
 
-    std::cout << result << '\n';
+    //part b, falls back to unbounded counts when 128 bits are not enough
+    if(auto arrangements = count_arrangements<wide_count_t>(joltages, gaps))
+        std::cout << to_string(*arrangements) << '\n';
+    else
+        std::cout << to_string(*count_arrangements<BigCount>(joltages, gaps)) << '\n';
 
     return 0;
 }
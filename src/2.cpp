@@ -1,78 +1,216 @@
 #include <iostream>
 #include <fstream>
-#include <tuple>
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <cassert>
 #include <iterator>
-#include <sstream>
+#include <thread>
+#include <utility>
+#include <cstddef>
 #include <ios>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86_KERNELS
+#endif
 
-int main(int argc, char *argv[])
+//a record points straight into the input buffer, nothing is copied
+struct PasswordRecord
 {
-    assert(("expected input", argc == 2));
+    const char *password;
+    std::size_t length;
+    int left_bound;
+    int right_bound;
+    char valid_char;
+};
+
+//kernels may read up to this many bytes past the start of a password,
+//the input buffer is padded so that never goes out of it
+constexpr std::size_t PASSWORD_PADDING = 32;
+
+inline std::size_t count_char_scalar(const char *first, std::size_t length, char c)
+{
+    std::size_t n = 0;
+    for(std::size_t i = 0; i != length; ++i)
+        n += first[i] == c;
+    return n;
+}
 
-    using password_entry_t = std::tuple<int, int, char, std::string>;
+#ifdef HAS_X86_KERNELS
+//Passwords are short, so each one is a single compare: the whole block is
+//loaded, and the bytes past the password are dropped from the movemask
+//before counting. Only passwords longer than a block loop.
 
-    std::vector<password_entry_t> passwords_list;
+//16 characters per compare; SSE2 is part of the x86-64 baseline
+inline std::size_t count_char_sse2(const char *first, std::size_t length, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+    std::size_t n = 0;
+    for(; length > 16; first += 16, length -= 16)
+    {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+    }
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+    const unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)) & ((1u << length) - 1);
+    return n + __builtin_popcount(mask);
+}
 
-    std::ifstream ifs{argv[1]};
+//32 characters per compare
+__attribute__((target("avx2,popcnt")))
+inline std::size_t count_char_avx2(const char *first, std::size_t length, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+    std::size_t n = 0;
+    for(; length > 32; first += 32, length -= 32)
+    {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+        n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+    }
+    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+    const unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+    return n + __builtin_popcount(length == 32 ? mask : mask & ((1u << length) - 1));
+}
+#endif
 
-    while(!ifs.eof())
+//parses "left-right c: password" starting at first, returns where the next line starts
+const char *parse_record(const char *first, const char *last, PasswordRecord &record)
+{
+    auto parse_int = [&](int &value)
     {
-        std::string str;
-        if(std::getline(ifs, str))
-        {
-            //"remove" special characters
-            auto sep = str.find('-');
-            str[sep] = ' ';
-            auto colon = str.find(':');
-            str[colon] = ' ';
-
-            std::istringstream isbuf{str};
-            int left_bound, right_bound;
-            char valid_char;
-            std::string password;
-            isbuf >> left_bound >> right_bound >> valid_char >> password;
-            passwords_list.emplace_back(left_bound, right_bound, valid_char, password);
+        value = 0;
+        while(first != last && '0' <= *first && *first <= '9')
+            value = value * 10 + (*first++ - '0');
+    };
+
+    parse_int(record.left_bound);
+    ++first; //'-'
+    parse_int(record.right_bound);
+    ++first; //' '
+    record.valid_char = *first;
+    first = std::min(first + 3, last); //"c: "
+    record.password = first;
+    first = std::find(first, last, '\n');
+    record.length = first - record.password;
+    return first == last ? last : first + 1;
+}
+
+using valid_counters_t = std::pair<std::size_t, std::size_t>;
+
+//both policies are checked in the same pass over each record. The counting
+//kernel is a template argument so it is inlined in the loop over records
+//this takes O(chunk size / vector width)
+template<std::size_t (*CountChar)(const char *, std::size_t, char)>
+inline __attribute__((always_inline)) valid_counters_t validate_records(const char *first, const char *last)
+{
+    valid_counters_t counters{0, 0};
+    PasswordRecord record;
+    while(first != last)
+    {
+        if(*first == '\n') { //blank line
+            ++first;
+            continue;
         }
+        first = parse_record(first, last, record);
+
+        const auto n_valid_char = CountChar(record.password, record.length, record.valid_char);
+        counters.first += static_cast<std::size_t>(record.left_bound) <= n_valid_char &&
+                          n_valid_char <= static_cast<std::size_t>(record.right_bound);
+
+        //positions are 1-based, anything out of the password does not contain the character
+        auto contains_valid_at = [&](int pos)
+        {
+            return 1 <= pos && static_cast<std::size_t>(pos) <= record.length && record.password[pos-1] == record.valid_char; //this takes O(1)
+        };
+        counters.second += contains_valid_at(record.left_bound) != contains_valid_at(record.right_bound);
     }
+    return counters;
+}
 
-    auto is_valid_policy_1 = [](password_entry_t const& password_entry)
-    {
-        int left_bound, right_bound;
-        char valid_char;
-        std::string password;
-        std::tie(left_bound, right_bound, valid_char, password) = password_entry;
+using validate_kernel_t = valid_counters_t (*)(const char *first, const char *last);
 
-        auto n_valid_char = std::count(std::begin(password), std::end(password), valid_char); //this takes O(string size)
-        return left_bound <= n_valid_char && n_valid_char <= right_bound;
-    };
+valid_counters_t validate_chunk_scalar(const char *first, const char *last)
+{
+    return validate_records<count_char_scalar>(first, last);
+}
 
-    //this takes O(passwords_list size * string size)
-    auto valid_passwords = std::count_if(std::begin(passwords_list), std::end(passwords_list), is_valid_policy_1);
+#ifdef HAS_X86_KERNELS
+valid_counters_t validate_chunk_sse2(const char *first, const char *last)
+{
+    return validate_records<count_char_sse2>(first, last);
+}
 
-    std::cout << "valid passwords according to policy 1: " << valid_passwords << '\n';
+__attribute__((target("avx2,popcnt")))
+valid_counters_t validate_chunk_avx2(const char *first, const char *last)
+{
+    return validate_records<count_char_avx2>(first, last);
+}
+#endif
+
+//chosen once at startup depending on what the cpu supports
+validate_kernel_t select_validate_kernel()
+{
+#ifdef HAS_X86_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        return validate_chunk_avx2;
+    if(__builtin_cpu_supports("sse2"))
+        return validate_chunk_sse2;
+#endif
+    return validate_chunk_scalar;
+}
 
-    auto is_valid_policy_2 = [](password_entry_t const& password_entry)
+int main(int argc, char *argv[])
+{
+    assert(("expected input", argc == 2));
+
+    //the whole file is loaded at once and parsed in place
+    std::ifstream ifs{argv[1], std::ios::binary};
+    std::string input{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+    const auto input_size = input.size();
+    input.append(PASSWORD_PADDING, '\0');
+
+    const validate_kernel_t validate_chunk = select_validate_kernel();
+    const char *first = input.data();
+    const char *last = first + input_size;
+
+    //split the input in line-aligned chunks, one per thread
+    const std::size_t n_threads = std::max(1u, std::thread::hardware_concurrency());
+    const std::size_t chunk_size = input_size / n_threads + 1;
+    std::vector<valid_counters_t> thread_counters(n_threads);
+    std::vector<std::thread> workers;
+
+    const char *chunk_begin = first;
+    for(std::size_t i = 0; i != n_threads && chunk_begin != last; ++i)
     {
-        int pos1, pos2;
-        char valid_char;
-        std::string password;
-        std::tie(pos1, pos2, valid_char, password) = password_entry;
+        const char *chunk_end = last;
+        if(static_cast<std::size_t>(last - chunk_begin) > chunk_size)
+        {
+            chunk_end = std::find(chunk_begin + chunk_size, last, '\n');
+            chunk_end = chunk_end == last ? last : chunk_end + 1;
+        }
 
-        bool contains_valid1 = password[pos1-1] == valid_char; //this takes O(1)
-        bool contains_valid2 = password[pos2-1] == valid_char; //this takes O(1)
+        workers.emplace_back([&thread_counters, i, chunk_begin, chunk_end, validate_chunk]
+        {
+            thread_counters[i] = validate_chunk(chunk_begin, chunk_end);
+        });
+        chunk_begin = chunk_end;
+    }
 
-        return !(contains_valid1 && contains_valid2) && (contains_valid1 || contains_valid2);
-    };
+    for(auto &worker : workers)
+        worker.join();
 
-    //this takes O(passwords_list size * string size)
-    valid_passwords = std::count_if(std::begin(passwords_list), std::end(passwords_list), is_valid_policy_2);
+    //O(number of threads)
+    valid_counters_t valid_passwords{0, 0};
+    for(auto const& counters : thread_counters)
+    {
+        valid_passwords.first += counters.first;
+        valid_passwords.second += counters.second;
+    }
 
-    std::cout << "valid passwords according to policy 2: " << valid_passwords << '\n';
+    std::cout << "valid passwords according to policy 1: " << valid_passwords.first << '\n';
+    std::cout << "valid passwords according to policy 2: " << valid_passwords.second << '\n';
 
     return 0;
 }
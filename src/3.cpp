@@ -1,58 +1,248 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
-#include <iterator>
 #include <vector>
-#include <algorithm>
-#include <array>
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <map>
+#include <cstdlib>
 
 
-//This takes O(toboggan_grid size) since all the other operations occur in constant time
-int main(int argc, char *argv[])
+//strategies with first as horizontal stride and second as vertical stride
+using slope_t = std::pair<std::size_t, std::size_t>;
+
+//each row is packed as a bitmask where a set bit is a tree, so a
+//row of 31 tiles fits in a single word
+struct TobogganGrid
 {
-    assert(("expected input", argc == 2));
+    //returns false and leaves the grid unchanged if the row is not as wide as the first one
+    bool add_row(std::string const& row)
+    {
+        if(width == 0) {
+            width = row.size();
+            words_per_row = (width + 63) / 64;
+        }
 
-    //strategies with first as horizontal stride and second as vertical stride
-    std::array<std::pair<std::size_t, std::size_t>, 5> strategies = {
-        std::make_pair(1, 1), {3, 1}, {5, 1}, {7, 1}, {1, 2}
-    };
+        if(row.size() != width)
+            return false;
+        tiles.resize(tiles.size() + words_per_row, 0);
+        auto row_bits = std::end(tiles) - words_per_row;
+        for(std::size_t column = 0; column != width; ++column)
+        {
+            if(row[column] == '#')
+                row_bits[column / 64] |= std::uint64_t{1} << (column % 64);
+        }
+        ++height;
+        return true;
+    }
 
+    bool is_tree(std::size_t row, std::size_t column) const
+    {
+        return (tiles[row * words_per_row + column / 64] >> (column % 64)) & 1;
+    }
 
-    std::vector<std::string> toboggan_grid;
+    std::size_t width{};
+    std::size_t height{};
+    std::size_t words_per_row{};
+    std::vector<std::uint64_t> tiles;
+};
 
-    //read input
-    std::ifstream ifs{argv[1]};
+//keeps only a column and a tree tally per slope, so rows can be
+//consumed as they arrive without materialising the grid
+//O(number of slopes) memory regardless of the grid height
+class SlopeWalker
+{
+public:
+    //vertical strides must be positive
+    explicit SlopeWalker(std::vector<slope_t> const& slopes) :
+        _slopes{slopes}, _hpos(slopes.size(), 0), _vpos(slopes.size()), _trees(slopes.size(), 0)
+    {
+        //the starting point is not an encounter, so the first row checked is one stride below
+        for(std::size_t i = 0; i != _slopes.size(); ++i)
+        {
+            assert(_slopes[i].second > 0);
+            _vpos[i] = _slopes[i].second;
+        }
+    }
+
+    //O(number of slopes)
+    void push_row(std::string const& row)
+    {
+        for(std::size_t i = 0; i != _slopes.size(); ++i)
+        {
+            if(_vpos[i] != _row)
+                continue;
+
+            _hpos[i] = (_hpos[i] + _slopes[i].first) % row.size();
+            _trees[i] += row[_hpos[i]] == '#';
+            _vpos[i] += _slopes[i].second;
+        }
+        ++_row;
+    }
+
+    std::vector<std::size_t> const& trees() const
+    {
+        return _trees;
+    }
+
+private:
+    const std::vector<slope_t> _slopes;
+    std::vector<std::size_t> _hpos;
+    std::vector<std::size_t> _vpos;
+    std::vector<std::size_t> _trees;
+    std::size_t _row{};
+};
+
+//Answers tree counts for arbitrary slopes over the same grid without walking it again.
+//
+//For a slope (right, down) the k-th row visited is k * down and its column is
+//(k * right) % width, which only depends on k % width and right % width. So for
+//each vertical stride the index keeps, per residue m of k and per column, how
+//many rows k * down with k % width == m have a tree there. A query then sums one
+//entry per residue, which is O(width) instead of O(grid height / down).
+//
+//Tables are built lazily the first time a vertical stride is seen, in
+//O(grid height / down * width) time and O(width^2) memory, and reused by every
+//later query with that stride. Queries are not thread safe since they may build a table.
+class SlopeIndex
+{
+public:
+    explicit SlopeIndex(TobogganGrid grid) : _grid{std::move(grid)}
+    {}
+
+    //vertical strides must be positive
+    std::size_t trees(slope_t const& slope)
+    {
+        auto [hstride, vstride] = slope;
+        assert(vstride > 0);
+        const auto width = _grid.width;
+        if(width == 0)
+            return 0;
 
-    std::copy(std::istream_iterator<std::string>{ifs}, std::istream_iterator<std::string>{},
-              std::back_inserter(toboggan_grid));
+        auto const& residue_table = table_for(vstride);
+        const auto right = hstride % width;
 
-    int trees_counter = 1;
+        //O(width)
+        std::size_t counter = 0;
+        for(std::size_t m = 0; m != width; ++m)
+            counter += residue_table[m * width + (m * right) % width];
 
-    //O(1) since number of strategies is limited
-    for(auto strategy : strategies )
+        return counter;
+    }
+
+    std::vector<std::size_t> trees(std::vector<slope_t> const& slopes)
     {
-        auto [hstride, vstride] = strategy;
-        auto current_hpos = hstride;
-        auto current_vpos = vstride;
+        std::vector<std::size_t> result;
+        result.reserve(slopes.size());
+        for(auto const& slope : slopes)
+            result.push_back(trees(slope));
 
-        const auto max_unique_length = toboggan_grid.at(0).size();
+        return result;
+    }
 
-        int tree_counter = 0;
+    TobogganGrid const& grid() const
+    {
+        return _grid;
+    }
+
+private:
+    std::vector<std::size_t> const& table_for(std::size_t vstride)
+    {
+        auto it = _residue_tables.find(vstride);
+        if(it != std::end(_residue_tables))
+            return it->second;
+
+        const auto width = _grid.width;
+        std::vector<std::size_t> residue_table(width * width, 0);
+        //k starts at 1 since the starting point is not an encounter
+        std::size_t m = 1 % width;
+        for(std::size_t row = vstride; row < _grid.height; row += vstride)
+        {
+            //only the set bits of the row are visited
+            for(std::size_t word = 0; word != _grid.words_per_row; ++word)
+            {
+                auto bits = _grid.tiles[row * _grid.words_per_row + word];
+                while(bits)
+                {
+                    const std::size_t column = word * 64 + __builtin_ctzll(bits);
+                    ++residue_table[m * width + column];
+                    bits &= bits - 1;
+                }
+            }
+            m = m + 1 == width ? 0 : m + 1;
+        }
+
+        return _residue_tables.emplace(vstride, std::move(residue_table)).first->second;
+    }
+
+    const TobogganGrid _grid;
+    std::map<std::size_t, std::vector<std::size_t>> _residue_tables;
+};
+
+//usage: input [right down]...
+//without slopes the default strategies are streamed through a SlopeWalker,
+//otherwise the grid is kept and each slope is answered by a SlopeIndex
+//This takes O(toboggan_grid size) time and O(number of strategies) memory since all the other operations occur in constant time
+int main(int argc, char *argv[])
+{
+    assert(("expected input, optionally followed by pairs of strides", argc >= 2 && argc % 2 == 0));
 
-        //O(toboggan_grid size)
-        while(current_vpos < toboggan_grid.size()) {
+    std::vector<slope_t> strategies = {
+        {1, 1}, {3, 1}, {5, 1}, {7, 1}, {1, 2}
+    };
 
-            //O(1)
-            char tile = toboggan_grid.at(current_vpos).at(current_hpos);
+    if(argc > 2)
+    {
+        strategies.clear();
+        for(int i = 2; i < argc; i += 2)
+        {
+            const long right = std::atol(argv[i]);
+            const long down = std::atol(argv[i + 1]);
+            if(right < 0 || down <= 0)
+            {
+                std::cerr << "invalid slope " << argv[i] << ' ' << argv[i + 1] << '\n';
+                return 1;
+            }
+            strategies.emplace_back(right, down);
+        }
+    }
 
-            current_hpos = (current_hpos + hstride) % max_unique_length;
-            current_vpos += vstride;
+    //read input
+    std::ifstream ifs{argv[1]};
 
-            if(tile == '#')
-                ++tree_counter;
+    std::vector<std::size_t> trees;
+    std::string row;
+    if(argc == 2)
+    {
+        //rows are dropped as soon as every slope went through them
+        SlopeWalker walker{strategies};
+        while(ifs >> row)
+            walker.push_row(row);
+        trees = walker.trees();
+    }
+    else
+    {
+        //O(grid height * width) to build the tables of each vertical stride, then O(width) per slope
+        TobogganGrid grid;
+        while(ifs >> row)
+        {
+            if(!grid.add_row(row))
+            {
+                std::cerr << "row " << grid.height + 1 << " has " << row.size() << " tiles, expected " << grid.width << '\n';
+                return 1;
+            }
         }
-        std::cout << "Right " << hstride << ", down " << vstride << ". Tree encounters: " << tree_counter << '\n';
-        trees_counter *= tree_counter;
+        SlopeIndex index{std::move(grid)};
+        trees = index.trees(strategies);
+    }
+
+    std::size_t trees_counter = 1;
+    for(std::size_t i = 0; i != strategies.size(); ++i)
+    {
+        auto [hstride, vstride] = strategies[i];
+        std::cout << "Right " << hstride << ", down " << vstride << ". Tree encounters: " << trees[i] << '\n';
+        trees_counter *= trees[i];
     }
 
     std::cout << "Trees multiplied: " << trees_counter << '\n';
@@ -1,150 +1,606 @@
 #include <iostream>
 #include <cassert>
 #include <fstream>
+#include <sstream>
 #include <iterator>
 #include <vector>
-#include <sstream>
+#include <string>
 #include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <numeric>
+#ifdef BENCHMARK
+#include <chrono>
 #include <set>
 #include <regex>
+#endif
 
 //assumptions:
 // - there are no spaces between the field name and the field value
 // - all fields per passport are unique
-// - all years values are numbers (so I don't need to check for its
-// size or if there are any funny character present)
-// - if height contains cm it will have exactly 3 numbers; otherwise,
-// if it contains in it will have exactly 2 numbers
+// - a passport has at most MAX_FIELDS different fields
+
+//The rules are not hardcoded anymore. They are described by a schema,
+//one field per line:
+//
+//  <name> <required|optional> <rule>
+//
+//where rule is one of:
+//  any                                  any value is accepted
+//  number <digits> <min> <max>          exactly digits digits (0 for any) within [min, max]
+//  units <suffix> <min> <max> ...       a number followed by one of the suffixes, within its range
+//  pattern <pattern>                    literals and [classes], each optionally repeated with {n}
+//  oneof <value> ...                    one of the listed values
+//
+//The schema is compiled once at startup into a table of rules indexed by
+//field slot, so changing the rules does not require recompiling.
+const char *default_schema = R"(byr required number 4 1920 2002
+iyr required number 4 2010 2020
+eyr required number 4 2020 2030
+hgt required units cm 150 193 in 59 76
+hcl required pattern #[0-9a-f]{6}
+ecl required oneof amb blu brn gry grn hzl oth
+pid required pattern [0-9]{9}
+cid optional any
+)";
 
-struct SimplePassport
+constexpr std::size_t MAX_FIELDS = 32;
+
+//maps field names to dense slots with a perfect hash found when the
+//schema is compiled, so a lookup is a single probe plus a compare
+class FieldTable
 {
-    explicit SimplePassport(std::string const& passport_fields) : _passport_fields{passport_fields}
+public:
+    static std::optional<FieldTable> build(std::vector<std::string> const& names)
+    {
+        //try seeds until no two names share a bucket, growing the table if it gets crowded
+        for(std::size_t buckets = 2; buckets <= 1u << 16; buckets *= 2)
+        {
+            if(buckets < names.size())
+                continue;
+
+            for(std::uint32_t seed = 0; seed != 1024; ++seed)
+            {
+                FieldTable table{names, seed, buckets};
+                if(table._perfect)
+                    return table;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    //returns the slot of a field name or -1 if it is not in the schema
+    int slot(std::string_view name) const
+    {
+        const int slot = _slots[hash(name)];
+        return slot != -1 && _names[slot] == name ? slot : -1;
+    }
+
+    std::vector<std::string> const& names() const
+    {
+        return _names;
+    }
+
+private:
+    FieldTable(std::vector<std::string> const& names, std::uint32_t seed, std::size_t buckets) :
+        _names{names}, _seed{seed}, _mask{buckets - 1}, _slots(buckets, -1)
+    {
+        for(std::size_t i = 0; i != _names.size(); ++i)
+        {
+            auto &slot = _slots[hash(_names[i])];
+            if(slot != -1) {
+                _perfect = false;
+                return;
+            }
+            slot = static_cast<int>(i);
+        }
+    }
+
+    //FNV-1a
+    std::size_t hash(std::string_view name) const
+    {
+        std::uint32_t h = 2166136261u ^ _seed;
+        for(unsigned char c : name)
+            h = (h ^ c) * 16777619u;
+        return h & _mask;
+    }
+
+    std::vector<std::string> _names;
+    std::uint32_t _seed;
+    std::size_t _mask;
+    std::vector<int> _slots;
+    bool _perfect{true};
+};
+
+//a passport is a fixed set of slots pointing into the input buffer
+struct PassportRecord
+{
+    std::array<std::string_view, MAX_FIELDS> fields;
+    std::uint32_t present{}; //bit i set when fields[i] was found
+};
+
+//splits blank-line separated records directly in the input buffer
+class PassportParser
+{
+public:
+    PassportParser(std::string_view buffer, FieldTable const& field_table) :
+        _buffer{buffer}, _field_table{field_table}
     {}
 
-    virtual bool is_valid() const {
-        //std::cend(passport_fields) - 1: to ignore the last space that were included during the parsing phase
-        auto n_field_separators = std::count(std::cbegin(_passport_fields), std::cend(_passport_fields) - 1, ' ');
-        return (n_field_separators == 7) || // if there are 7 separators, that means 8 fields
-               (n_field_separators == 6 && _passport_fields.find("cid:") == std::string::npos); //since cid is optional
+    //O(record size)
+    bool next(PassportRecord &record)
+    {
+        record.present = 0;
+
+        //skip the blank lines before the record
+        while(_pos != _buffer.size() && _buffer[_pos] == '\n')
+            ++_pos;
+        if(_pos == _buffer.size())
+            return false;
+
+        //a record ends on an empty line or at the end of the buffer
+        while(_pos != _buffer.size() && !(_buffer[_pos] == '\n' && _pos > 0 && _buffer[_pos - 1] == '\n'))
+        {
+            if(_buffer[_pos] == ' ' || _buffer[_pos] == '\n') {
+                ++_pos;
+                continue;
+            }
+
+            const auto entry_end = std::min(_buffer.find_first_of(" \n", _pos), _buffer.size());
+            const auto entry = _buffer.substr(_pos, entry_end - _pos);
+            _pos = entry_end;
+
+            const auto colon = entry.find(':');
+            if(colon == std::string_view::npos)
+                continue;
+
+            const int slot = _field_table.slot(entry.substr(0, colon));
+            if(slot == -1)
+                continue;
+
+            record.fields[slot] = entry.substr(colon + 1);
+            record.present |= std::uint32_t{1} << slot;
+        }
+
+        return true;
     }
 
-    const std::string _passport_fields;
+private:
+    std::string_view _buffer;
+    FieldTable const& _field_table;
+    std::size_t _pos{};
 };
 
-struct ComplexPassport : public SimplePassport
+namespace validators
 {
-    using SimplePassport::SimplePassport;
+    bool is_digit(char c)
+    {
+        return '0' <= c && c <= '9';
+    }
 
-    bool is_valid() const override {
-        if(!SimplePassport::is_valid())
+    //value must be made only of digits and be within [min, max]
+    bool is_number_in(std::string_view value, long min, long max)
+    {
+        if(value.empty() || value.size() > 18)
             return false;
 
-        //since all fields are here, we can parse and check them
-        std::istringstream iss{_passport_fields};
-        std::string entry;
-        bool valid = true;
-        while(iss >> entry)
+        long number = 0;
+        for(auto c : value)
         {
-            std::string field{entry.substr(0, 3)};
-            std::string value{entry.substr(4)};
+            if(!is_digit(c))
+                return false;
+            number = number * 10 + (c - '0');
+        }
+        return min <= number && number <= max;
+    }
+}
 
-            if(field == "byr")
-            {
-                int year = std::stoi(value);
-                valid &= (1920 <= year && year <= 2002);
-            }
-            else if(field == "iyr")
+struct UnitRange
+{
+    std::string suffix; //empty for plain numbers
+    long min;
+    long max;
+};
+
+//a character class repeated exactly count times
+struct PatternElement
+{
+    std::bitset<256> chars;
+    std::size_t count;
+};
+
+struct FieldRule
+{
+    enum class Kind {ANY, NUMBER, PATTERN, ONE_OF};
+
+    Kind kind{Kind::ANY};
+    std::size_t digits{}; //NUMBER: exact number of digits, 0 for any
+    std::vector<UnitRange> units; //NUMBER: accepted suffixes and ranges
+    std::vector<PatternElement> pattern; //PATTERN
+    std::vector<std::string> values; //ONE_OF
+
+    //O(value size) except for ONE_OF which is O(number of values)
+    bool matches(std::string_view value) const
+    {
+        switch(kind)
+        {
+        case Kind::ANY:
+            return true;
+        case Kind::NUMBER:
+            for(auto const& unit : units)
             {
-                int year = std::stoi(value);
-                valid &= (2010 <= year && year <= 2020);
+                if(value.size() < unit.suffix.size() || value.substr(value.size() - unit.suffix.size()) != unit.suffix)
+                    continue;
+                const auto number = value.substr(0, value.size() - unit.suffix.size());
+                if(digits != 0 && number.size() != digits)
+                    continue;
+                if(validators::is_number_in(number, unit.min, unit.max))
+                    return true;
             }
-            else if(field == "eyr")
+            return false;
+        case Kind::PATTERN:
+        {
+            std::size_t pos = 0;
+            for(auto const& element : pattern)
             {
-                int year = std::stoi(value);
-                valid &= (2020 <= year && year <= 2030);
+                if(value.size() - pos < element.count)
+                    return false;
+                for(auto end = pos + element.count; pos != end; ++pos)
+                    if(!element.chars[static_cast<unsigned char>(value[pos])])
+                        return false;
             }
-            else if(field == "hgt")
+            return pos == value.size();
+        }
+        case Kind::ONE_OF:
+            return std::find(std::cbegin(values), std::cend(values), value) != std::cend(values);
+        }
+
+        return false;
+    }
+};
+
+//parses a pattern such as #[0-9a-f]{6} into its elements
+std::optional<std::vector<PatternElement>> compile_pattern(std::string_view text)
+{
+    std::vector<PatternElement> elements;
+    std::size_t pos = 0;
+    while(pos != text.size())
+    {
+        PatternElement element{{}, 1};
+        if(text[pos] == '[')
+        {
+            const auto close = text.find(']', pos);
+            if(close == std::string_view::npos)
+                return std::nullopt;
+            for(++pos; pos != close; ++pos)
             {
-                if(value.find("cm") != std::string::npos)
-                {
-                    int height = std::stoi(value.substr(0, 3));
-                    valid &= (150 <= height && height <= 193);
-                } else if(value.find("in") != std::string::npos)
-                {
-                    int height = std::stoi(value.substr(0, 2));
-                    valid &= (59 <= height && height <= 76);
+                if(pos + 2 < close && text[pos + 1] == '-') {
+                    for(int c = static_cast<unsigned char>(text[pos]); c <= static_cast<unsigned char>(text[pos + 2]); ++c)
+                        element.chars.set(c);
+                    pos += 2;
                 } else {
-                    valid = false;
-                    break; //no need to continue
+                    element.chars.set(static_cast<unsigned char>(text[pos]));
                 }
             }
-            else if(field == "hcl")
-            {
-                std::smatch match;
-                std::regex pattern{"#[[:digit:]a-f]{6}"};
-                valid &= std::regex_match(value, match, pattern);
-            }
-            else if(field == "ecl")
-            {
-                const std::set<std::string> eye_color{"amb", "blu", "brn", "gry", "grn", "hzl", "oth"};
-                valid &= eye_color.find(value) != std::end(eye_color);
-            }
-            else if(field == "pid")
-            {
-                std::smatch match;
-                std::regex pattern{"[[:digit:]]{9}"};
-                valid &= std::regex_match(value, match, pattern);
-            }
-            else if(field == "cid")
+            ++pos; //']'
+        }
+        else
+        {
+            element.chars.set(static_cast<unsigned char>(text[pos++]));
+        }
+
+        if(pos != text.size() && text[pos] == '{')
+        {
+            const auto close = text.find('}', pos);
+            if(close == std::string_view::npos)
+                return std::nullopt;
+            element.count = 0;
+            for(++pos; pos != close; ++pos)
             {
-                //ignore
+                if(!validators::is_digit(text[pos]))
+                    return std::nullopt;
+                element.count = element.count * 10 + (text[pos] - '0');
             }
-
+            ++pos; //'}'
         }
 
-        //std::cout << "Passport -> " << _passport_fields << ". Valid: " << std::boolalpha << valid << '\n';
+        elements.push_back(element);
+    }
+
+    return elements;
+}
+
+//the schema compiled into a rule per field slot plus the bitmask of required slots
+struct PassportSchema
+{
+    FieldTable field_table;
+    std::vector<FieldRule> rules;
+    std::uint32_t required{};
+
+    bool has_required_fields(PassportRecord const& record) const
+    {
+        return (record.present & required) == required;
+    }
+
+    //O(number of fields in the schema)
+    bool is_valid(PassportRecord const& record) const
+    {
+        if(!has_required_fields(record))
+            return false;
+
+        bool valid = true;
+        for(std::size_t slot = 0; slot != rules.size(); ++slot)
+        {
+            const bool present = (record.present >> slot) & 1;
+            valid &= !present || rules[slot].matches(record.fields[slot]);
+        }
         return valid;
     }
 };
 
+//returns nothing and reports the offending line when the schema is malformed
+std::optional<PassportSchema> compile_schema(std::istream &is)
+{
+    std::vector<std::string> names;
+    std::vector<FieldRule> rules;
+    std::uint32_t required{};
 
-int main(int argc, char *argv[])
+    std::string line;
+    int line_number = 0;
+    while(std::getline(is, line))
+    {
+        ++line_number;
+        std::istringstream iss{line};
+        std::string name, presence, kind;
+        if(!(iss >> name))
+            continue; //empty line
+
+        auto error = [&](std::string const& message)
+        {
+            std::cerr << "schema line " << line_number << ": " << message << '\n';
+            return std::nullopt;
+        };
+
+        if(!(iss >> presence >> kind))
+            return error("expected <name> <required|optional> <rule>");
+        if(std::find(std::cbegin(names), std::cend(names), name) != std::cend(names))
+            return error("duplicated field " + name);
+        if(names.size() == MAX_FIELDS)
+            return error("too many fields");
+
+        if(presence == "required")
+            required |= std::uint32_t{1} << names.size();
+        else if(presence != "optional")
+            return error("unknown presence " + presence);
+
+        FieldRule rule;
+        if(kind == "any")
+        {
+            rule.kind = FieldRule::Kind::ANY;
+        }
+        else if(kind == "number")
+        {
+            rule.kind = FieldRule::Kind::NUMBER;
+            UnitRange range{"", 0, 0};
+            if(!(iss >> rule.digits >> range.min >> range.max) || !(iss >> std::ws).eof())
+                return error("expected number <digits> <min> <max>");
+            rule.units.push_back(range);
+        }
+        else if(kind == "units")
+        {
+            rule.kind = FieldRule::Kind::NUMBER;
+            UnitRange range;
+            while(iss >> range.suffix >> range.min >> range.max)
+                rule.units.push_back(range);
+            if(rule.units.empty() || !iss.eof())
+                return error("expected units <suffix> <min> <max> ...");
+        }
+        else if(kind == "pattern")
+        {
+            rule.kind = FieldRule::Kind::PATTERN;
+            std::string text;
+            if(!(iss >> text) || !(iss >> std::ws).eof())
+                return error("expected pattern <text>");
+            auto pattern = compile_pattern(text);
+            if(!pattern)
+                return error("malformed pattern " + text);
+            rule.pattern = std::move(*pattern);
+        }
+        else if(kind == "oneof")
+        {
+            rule.kind = FieldRule::Kind::ONE_OF;
+            std::copy(std::istream_iterator<std::string>{iss}, std::istream_iterator<std::string>{},
+                      std::back_inserter(rule.values));
+            if(rule.values.empty())
+                return error("expected oneof <value> ...");
+        }
+        else
+        {
+            return error("unknown rule " + kind);
+        }
+
+        names.push_back(name);
+        rules.push_back(std::move(rule));
+    }
+
+    auto field_table = FieldTable::build(names);
+    if(!field_table)
+    {
+        std::cerr << "could not find a perfect hash for the schema fields\n";
+        return std::nullopt;
+    }
+
+    return PassportSchema{std::move(*field_table), std::move(rules), required};
+}
+
+//the last passport of a chunk does not need special handling since the parser stops at its end
+//O(chunk size)
+std::size_t count_valid_passports(std::string_view chunk, PassportSchema const& schema)
 {
-    assert(("expected input", argc == 2));
+    PassportParser parser{chunk, schema.field_table};
+    PassportRecord record;
+    std::size_t count_valid_passports{0};
+    while(parser.next(record))
+        count_valid_passports += schema.is_valid(record);
 
-    std::ifstream ifs{argv[1]};
+    return count_valid_passports;
+}
 
-    std::string line;
-    std::ostringstream oss;
-    int count_valid_passports{0};
-    while(std::getline(ifs, line))
+#ifdef BENCHMARK
+//the previous regex based validation of the default schema, kept to compare throughput against
+bool is_valid_regex(PassportSchema const& schema, PassportRecord const& record)
+{
+    if(!schema.has_required_fields(record))
+        return false;
+
+    bool valid = true;
+    for(std::size_t slot = 0; slot != schema.rules.size(); ++slot)
     {
-        if(line.empty()){
-            auto passport = ComplexPassport(oss.str());
-            if(passport.is_valid())
-            {
-                ++count_valid_passports;
-            }
-            oss.str("");
+        const std::string field{schema.field_table.names()[slot]};
+        const std::string value{record.fields[slot]};
+
+        if(field == "byr")
+        {
+            int year = std::stoi(value);
+            valid &= (1920 <= year && year <= 2002);
+        }
+        else if(field == "iyr")
+        {
+            int year = std::stoi(value);
+            valid &= (2010 <= year && year <= 2020);
+        }
+        else if(field == "eyr")
+        {
+            int year = std::stoi(value);
+            valid &= (2020 <= year && year <= 2030);
         }
-        else {
-            std::string current_field;
-            std::istringstream iss{line};
-            while(iss >> current_field)
+        else if(field == "hgt")
+        {
+            if(value.find("cm") != std::string::npos)
+            {
+                int height = std::stoi(value.substr(0, 3));
+                valid &= (150 <= height && height <= 193);
+            } else if(value.find("in") != std::string::npos)
             {
-                oss << current_field << ' ';
+                int height = std::stoi(value.substr(0, 2));
+                valid &= (59 <= height && height <= 76);
+            } else {
+                valid = false;
+                break; //no need to continue
             }
         }
+        else if(field == "hcl")
+        {
+            std::smatch match;
+            std::regex pattern{"#[[:digit:]a-f]{6}"};
+            valid &= std::regex_match(value, match, pattern);
+        }
+        else if(field == "ecl")
+        {
+            const std::set<std::string> eye_color{"amb", "blu", "brn", "gry", "grn", "hzl", "oth"};
+            valid &= eye_color.find(value) != std::end(eye_color);
+        }
+        else if(field == "pid")
+        {
+            std::smatch match;
+            std::regex pattern{"[[:digit:]]{9}"};
+            valid &= std::regex_match(value, match, pattern);
+        }
+    }
+
+    return valid;
+}
+
+//validates every passport rounds times and reports the throughput
+template<typename Validator>
+void benchmark(std::string const& name, std::vector<PassportRecord> const& passports, int rounds, Validator is_valid)
+{
+    std::size_t count_valid_passports{0};
+    const auto start = std::chrono::steady_clock::now();
+    for(int round = 0; round != rounds; ++round)
+    {
+        for(auto const& record : passports)
+            count_valid_passports += is_valid(record);
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << name << ": " << count_valid_passports / rounds << " valid, "
+              << (passports.size() * rounds) / elapsed.count() << " passports/s\n";
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    assert(("expected input and optionally a schema", argc == 2 || argc == 3));
+
+    std::optional<PassportSchema> schema;
+    if(argc == 3) {
+        std::ifstream schema_ifs{argv[2]};
+        if(!schema_ifs)
+        {
+            std::cerr << "cannot open schema " << argv[2] << '\n';
+            return 1;
+        }
+        schema = compile_schema(schema_ifs);
+    } else {
+        std::istringstream schema_iss{default_schema};
+        schema = compile_schema(schema_iss);
     }
 
-    //test last passport
-    auto passport = ComplexPassport(oss.str());
-    if(passport.is_valid())
+    if(!schema)
+        return 1;
+
+    //the whole file is loaded at once and records are parsed in place
+    std::ifstream ifs{argv[1], std::ios::binary};
+    const std::string input{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+
+    //split the input in record-aligned chunks, one per thread, cutting only on blank lines
+    const std::string_view buffer{input};
+    const std::size_t n_threads = std::max(1u, std::thread::hardware_concurrency());
+    const std::size_t chunk_size = buffer.size() / n_threads + 1;
+    std::vector<std::size_t> thread_counters(n_threads, 0);
+    std::vector<std::thread> workers;
+
+    std::size_t chunk_begin = 0;
+    for(std::size_t i = 0; i != n_threads && chunk_begin != buffer.size(); ++i)
     {
-        ++count_valid_passports;
+        std::size_t chunk_end = buffer.size();
+        if(buffer.size() - chunk_begin > chunk_size)
+            chunk_end = std::min(buffer.find("\n\n", chunk_begin + chunk_size), buffer.size());
+
+        const auto chunk = buffer.substr(chunk_begin, chunk_end - chunk_begin);
+        workers.emplace_back([&thread_counters, &schema, i, chunk]
+        {
+            thread_counters[i] = count_valid_passports(chunk, *schema);
+        });
+        chunk_begin = chunk_end;
     }
 
-    std::cout << "Number of valid passports " << count_valid_passports << '\n';
+    for(auto &worker : workers)
+        worker.join();
+
+    //O(number of threads)
+    const auto valid_passports = std::accumulate(std::cbegin(thread_counters), std::cend(thread_counters), std::size_t{0});
+
+    std::cout << "Number of valid passports " << valid_passports << '\n';
+
+#ifdef BENCHMARK
+    //build with -DBENCHMARK to compare the compiled schema against the regex validation
+    std::vector<PassportRecord> passports;
+    PassportParser parser{buffer, schema->field_table};
+    PassportRecord record;
+    while(parser.next(record))
+        passports.push_back(record);
+
+    const int rounds = 200;
+    benchmark("regex", passports, rounds, [&](PassportRecord const& r) { return is_valid_regex(*schema, r); });
+    benchmark("compiled schema", passports, rounds, [&](PassportRecord const& r) { return schema->is_valid(r); });
+#endif
 
     return 0;
 }
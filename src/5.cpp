@@ -1,75 +1,342 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
-#include <vector>
 #include <string>
-#include <algorithm>
-#include <bitset>
-#include <set>
+#include <iterator>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86_KERNELS
+#endif
 
 
 //the entry is nothing more than binary encoded: FBBBFFFLRL would be
 //0111000010 where the first 7 digits is the row number in base 10,
-//and the last 3 digits is the column in base 10.
+//and the last 3 digits is the column in base 10. Since the row is
+//multiplied by 2^column bits the seat id is just the whole number.
 
-//using set makes the insert log n. unordered_set would have been O(1)
+//how many letters encode the row and the column and which letters mean 0 and 1
+struct SeatGeometry
+{
+    unsigned row_bits;
+    unsigned column_bits;
+    char row_zero, row_one;
+    char column_zero, column_one;
 
-//O(number of entries encoded * size of the seat encoding) + O(number of entries decoded)
-int main(int argc, char *argv[])
+    constexpr std::size_t pass_length() const
+    {
+        return row_bits + column_bits;
+    }
+
+    constexpr std::size_t seats() const
+    {
+        return std::size_t{1} << pass_length();
+    }
+
+    //the letter meaning 1 at position i of a pass
+    constexpr char one_at(std::size_t i) const
+    {
+        return i < row_bits ? row_one : column_one;
+    }
+};
+
+constexpr SeatGeometry airplane{7, 3, 'F', 'B', 'L', 'R'};
+
+//kernels may read up to this many bytes from the start of a pass
+constexpr std::size_t PASS_PADDING = 16;
+//seat ids have to fit in an unsigned
+constexpr std::size_t MAX_PASS_LENGTH = 32;
+
+//one bit per seat id, set when the seat is taken
+struct SeatMap
+{
+    explicit SeatMap(SeatGeometry const& geometry) : words((geometry.seats() + 63) / 64, 0)
+    {}
+
+    void insert(std::size_t seat_id)
+    {
+        words[seat_id / 64] |= std::uint64_t{1} << (seat_id % 64);
+    }
+
+    std::vector<std::uint64_t> words;
+};
+
+bool is_pass_separator(char c)
 {
-    assert(("expected input", argc == 2));
+    return c == '\n' || c == '\r' || c == ' ';
+}
 
-    std::ifstream ifs{argv[1]};
+//returns the start of the next pass at or after first, or nullptr if there is none
+const char *next_pass(const char *first, const char *last, std::size_t pass_length)
+{
+    while(first != last && is_pass_separator(*first))
+        ++first;
+    return static_cast<std::size_t>(last - first) >= pass_length ? first : nullptr;
+}
 
-    std::string current_seat;
-    unsigned long max_id = 0;
-    std::set<unsigned long> seats;
+//kernels return the first pass holding a letter that is neither the 0 nor
+//the 1 of its position, or nullptr when every pass was decoded
+using decode_kernel_t = const char *(*)(SeatGeometry const& geometry, const char *first, const char *last, SeatMap &seats);
 
-    while(ifs >> current_seat)
+//the letter meaning 0 at position i of a pass
+constexpr char zero_at(SeatGeometry const& geometry, std::size_t i)
+{
+    return i < geometry.row_bits ? geometry.row_zero : geometry.column_zero;
+}
+
+//shared by the generic and the fixed layout kernels, which only differ in
+//whether the geometry is known at compile time
+//O(number of passes * size of the seat encoding)
+inline __attribute__((always_inline))
+const char *decode_passes(SeatGeometry const& geometry, const char *first, const char *last, SeatMap &seats)
+{
+    const auto pass_length = geometry.pass_length();
+    while((first = next_pass(first, last, pass_length)))
     {
-        std::string rows{current_seat.substr(0, 7)};
-        std::string columns{current_seat.substr(7, 3)};
-        //O(1) - 7 characteres
-        std::for_each(std::begin(rows), std::end(rows), [](char &c)
-        {
-            if(c == 'F')
-                c = '0';
-            if(c == 'B')
-                c = '1';
-        });
-
-        //O(1) - 3 characteres
-        std::for_each(std::begin(columns), std::end(columns), [](char &c)
+        std::size_t seat_id = 0;
+        for(std::size_t i = 0; i != pass_length; ++i)
         {
-            if(c == 'R')
-                c = '1';
-            if(c == 'L')
-                c = '0';
-        });
-
-        std::bitset<7> r{rows};
-        std::bitset<3> c{columns};
-        auto row_number = r.to_ulong();
-        auto column_number = c.to_ulong();
-        auto seat_id = row_number * 8 + column_number;
-        //std::cout << current_seat << ": row " << row_number << ", column " << column_number << ", seat ID " << seat_id << '\n';
-        max_id = std::max(seat_id, max_id);
+            const bool one = first[i] == geometry.one_at(i);
+            if(!one && first[i] != zero_at(geometry, i))
+                return first;
+            seat_id = (seat_id << 1) | one;
+        }
         seats.insert(seat_id);
+        first += pass_length;
+    }
+    return nullptr;
+}
+
+//generic path for any geometry
+const char *decode_scalar(SeatGeometry const& geometry, const char *first, const char *last, SeatMap &seats)
+{
+    return decode_passes(geometry, first, last, seats);
+}
+
+//specialised for a layout known at compile time, so the loop is fully unrolled
+template<SeatGeometry const& Geometry>
+const char *decode_fixed(SeatGeometry const&, const char *first, const char *last, SeatMap &seats)
+{
+    return decode_passes(Geometry, first, last, seats);
+}
+
+#ifdef HAS_X86_KERNELS
+//the SIMD kernels handle passes of up to 16 letters. The shuffle reverses
+//the letters so the first one lands on the highest bit of the movemask,
+//and each lane is compared against the letters meaning 1 and 0 at its
+//position. Lanes past the pass are zeroed by the shuffle and masked out.
+struct SimdGeometry
+{
+    constexpr explicit SimdGeometry(SeatGeometry const& geometry) : reverse{}, ones{}, zeros{}, mask{}
+    {
+        const auto pass_length = geometry.pass_length();
+        for(std::size_t lane = 0; lane != 16; ++lane)
+        {
+            reverse[lane] = lane < pass_length ? static_cast<char>(pass_length - 1 - lane) : -1;
+            ones[lane] = lane < pass_length ? geometry.one_at(pass_length - 1 - lane) : 0;
+            zeros[lane] = lane < pass_length ? zero_at(geometry, pass_length - 1 - lane) : 0;
+        }
+        mask = (1u << pass_length) - 1;
+    }
+
+    alignas(16) char reverse[16];
+    alignas(16) char ones[16];
+    alignas(16) char zeros[16];
+    unsigned mask;
+};
+
+__attribute__((target("ssse3"))) inline __attribute__((always_inline))
+const char *decode_passes_ssse3(SeatGeometry const& geometry, const char *first, const char *last, SeatMap &seats)
+{
+    const SimdGeometry simd{geometry};
+    const __m128i reverse = _mm_load_si128(reinterpret_cast<const __m128i *>(simd.reverse));
+    const __m128i ones = _mm_load_si128(reinterpret_cast<const __m128i *>(simd.ones));
+    const __m128i zeros = _mm_load_si128(reinterpret_cast<const __m128i *>(simd.zeros));
+    const auto pass_length = geometry.pass_length();
+    while((first = next_pass(first, last, pass_length)))
+    {
+        const __m128i pass = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(first)), reverse);
+        const unsigned digits = _mm_movemask_epi8(_mm_cmpeq_epi8(pass, ones)) & simd.mask;
+        const unsigned letters = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(pass, ones), _mm_cmpeq_epi8(pass, zeros)));
+        if((letters & simd.mask) != simd.mask)
+            return first;
+        seats.insert(digits);
+        first += pass_length;
     }
+    return nullptr;
+}
 
-    std::cout << "max id " << max_id << '\n';
-    auto last = std::prev(std::end(seats));
+//two passes per compare, one in each 128 bits lane
+__attribute__((target("avx2"))) inline __attribute__((always_inline))
+const char *decode_passes_avx2(SeatGeometry const& geometry, const char *first, const char *last, SeatMap &seats)
+{
+    const SimdGeometry simd{geometry};
+    const __m256i reverse = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(simd.reverse)));
+    const __m256i ones = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(simd.ones)));
+    const __m256i zeros = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(simd.zeros)));
+    const unsigned both_masks = simd.mask | (simd.mask << 16);
+    const auto pass_length = geometry.pass_length();
+    while((first = next_pass(first, last, pass_length)))
+    {
+        const char *second = next_pass(first + pass_length, last, pass_length);
+        if(!second)
+            return decode_passes_ssse3(geometry, first, last, seats);
 
-    //O(number of seats)
-    for(auto i = std::begin(seats); i != last; ++i)
+        const __m256i passes = _mm256_shuffle_epi8(_mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(first))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(second)), 1), reverse);
+        const unsigned digits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(passes, ones));
+        const unsigned letters = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(passes, ones),
+                                                                      _mm256_cmpeq_epi8(passes, zeros)));
+        if((letters & both_masks) != both_masks)
+            return (letters & simd.mask) != simd.mask ? first : second;
+        seats.insert(digits & simd.mask);
+        seats.insert((digits >> 16) & simd.mask);
+        first = second + pass_length;
+    }
+    return nullptr;
+}
+
+__attribute__((target("ssse3")))
+const char *decode_ssse3(SeatGeometry const& geometry, const char *first, const char *last, SeatMap &seats)
+{
+    return decode_passes_ssse3(geometry, first, last, seats);
+}
+
+__attribute__((target("avx2")))
+const char *decode_avx2(SeatGeometry const& geometry, const char *first, const char *last, SeatMap &seats)
+{
+    return decode_passes_avx2(geometry, first, last, seats);
+}
+
+//the SIMD kernels for a layout known at compile time, where the shuffle
+//and the letters to compare against are constants
+template<SeatGeometry const& Geometry>
+__attribute__((target("ssse3")))
+const char *decode_ssse3_fixed(SeatGeometry const&, const char *first, const char *last, SeatMap &seats)
+{
+    return decode_passes_ssse3(Geometry, first, last, seats);
+}
+
+template<SeatGeometry const& Geometry>
+__attribute__((target("avx2")))
+const char *decode_avx2_fixed(SeatGeometry const&, const char *first, const char *last, SeatMap &seats)
+{
+    return decode_passes_avx2(Geometry, first, last, seats);
+}
+#endif
+
+bool same_layout(SeatGeometry const& geometry, SeatGeometry const& other)
+{
+    return geometry.row_bits == other.row_bits && geometry.column_bits == other.column_bits &&
+           geometry.row_zero == other.row_zero && geometry.row_one == other.row_one &&
+           geometry.column_zero == other.column_zero && geometry.column_one == other.column_one;
+}
+
+//chosen once at startup depending on the geometry and on what the cpu supports
+decode_kernel_t select_decode_kernel(SeatGeometry const& geometry)
+{
+    const bool is_airplane = same_layout(geometry, airplane);
+#ifdef HAS_X86_KERNELS
+    __builtin_cpu_init();
+    if(geometry.pass_length() <= 16)
     {
-        auto n = std::next(i);
-        if(*n - *i != 1) {
-            std::cout << "my seat id is " << *i + 1<< '\n';
-            break;
+        if(__builtin_cpu_supports("avx2"))
+            return is_airplane ? decode_avx2_fixed<airplane> : decode_avx2;
+        if(__builtin_cpu_supports("ssse3"))
+            return is_airplane ? decode_ssse3_fixed<airplane> : decode_ssse3;
+    }
+#endif
+    return is_airplane ? decode_fixed<airplane> : decode_scalar;
+}
+
+//O(number of words)
+std::optional<std::size_t> max_seat_id(SeatMap const& seats)
+{
+    for(std::size_t i = seats.words.size(); i-- != 0;)
+    {
+        if(seats.words[i])
+            return i * 64 + 63 - __builtin_clzll(seats.words[i]);
+    }
+    return std::nullopt;
+}
+
+//the free seat with both neighbours taken
+//O(number of words)
+std::optional<std::size_t> find_my_seat(SeatMap const& seats)
+{
+    const auto &words = seats.words;
+    for(std::size_t i = 0; i != words.size(); ++i)
+    {
+        //bit j of previous/next is set when seat j-1/j+1 is taken
+        const std::uint64_t previous = (words[i] << 1) | (i != 0 ? words[i - 1] >> 63 : 0);
+        const std::uint64_t next = (words[i] >> 1) | (i + 1 != words.size() ? words[i + 1] << 63 : 0);
+        const std::uint64_t candidates = ~words[i] & previous & next;
+        if(candidates)
+            return i * 64 + __builtin_ctzll(candidates);
+    }
+    return std::nullopt;
+}
+
+//usage: input [row_bits column_bits [row_letters column_letters]]
+//where the letters are given as the one meaning 0 followed by the one meaning 1, e.g. FB LR
+//O(number of entries encoded * size of the seat encoding / vector width) + O(number of seats / 64)
+int main(int argc, char *argv[])
+{
+    assert(("expected input, optionally followed by the geometry", argc == 2 || argc == 4 || argc == 6));
+
+    SeatGeometry geometry = airplane;
+    if(argc >= 4)
+    {
+        const long row_bits = std::atol(argv[2]);
+        const long column_bits = std::atol(argv[3]);
+        if(row_bits < 0 || column_bits < 0 || row_bits + column_bits < 1 ||
+           row_bits + column_bits > static_cast<long>(MAX_PASS_LENGTH))
+        {
+            std::cerr << "passes must have between 1 and " << MAX_PASS_LENGTH << " letters\n";
+            return 1;
+        }
+        geometry.row_bits = row_bits;
+        geometry.column_bits = column_bits;
+    }
+    if(argc == 6)
+    {
+        const std::string row_letters{argv[4]};
+        const std::string column_letters{argv[5]};
+        if(row_letters.size() != 2 || column_letters.size() != 2 ||
+           row_letters[0] == row_letters[1] || column_letters[0] == column_letters[1])
+        {
+            std::cerr << "letters are given in pairs of two different letters\n";
+            return 1;
         }
+        geometry.row_zero = row_letters[0];
+        geometry.row_one = row_letters[1];
+        geometry.column_zero = column_letters[0];
+        geometry.column_one = column_letters[1];
+    }
+
+    std::ifstream ifs{argv[1], std::ios::binary};
+    std::string input{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+    const auto input_size = input.size();
+    input.append(PASS_PADDING, '\0');
+
+    SeatMap seats{geometry};
+    const decode_kernel_t decode = select_decode_kernel(geometry);
+    if(const char *malformed = decode(geometry, input.data(), input.data() + input_size, seats))
+    {
+        std::cerr << "malformed boarding pass " << std::string{malformed, geometry.pass_length()} << '\n';
+        return 1;
     }
 
+    if(auto max_id = max_seat_id(seats))
+        std::cout << "max id " << *max_id << '\n';
+
+    if(auto my_seat = find_my_seat(seats))
+        std::cout << "my seat id is " << *my_seat << '\n';
 
     return 0;
 }
@@ -1,100 +1,225 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
-#include <sstream>
-#include <vector>
-#include <set>
-#include <numeric>
-#include <array>
-#include <algorithm>
-
-std::vector<int> check_answers_a(std::ifstream &ifs)
+#include <string>
+#include <string_view>
+#include <iterator>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+//each person's answers are a 32 bits mask where bit i is set if
+//question 'a' + i was answered. A group is the OR (part a, anyone
+//answered) and the AND (part b, everyone answered) of its people.
+//
+//I'm assuming that we are using an ASCII table where all
+//ASCII codes are sequential.
+
+struct AnswersCount
 {
-    std::string line;
-    std::ostringstream group;
-    std::vector<int> groups;
+    std::size_t anyone{}; //part a
+    std::size_t everyone{}; //part b
+};
 
-    //O(n) where n is the number of lines
-    while(!ifs.eof())
+//accumulates the people of the current group
+struct GroupAnswers
+{
+    void add_person(std::uint32_t person)
     {
-        std::getline(ifs, line);
-        if(line.empty())
-        {
-            auto group_str = group.str();
-            //O(m) where m is the number of answers per group
-            std::set<char> questions{std::cbegin(group_str), std::cend(group_str)};
-            groups.push_back(questions.size());
-            group.str("");
+        anyone |= person;
+        everyone &= person;
+        has_people = true;
+    }
+
+    //adds the group to the totals and starts a new one
+    void close(AnswersCount &count)
+    {
+        if(has_people) {
+            count.anyone += __builtin_popcount(anyone);
+            count.everyone += __builtin_popcount(everyone);
         }
-        else
+        *this = GroupAnswers{};
+    }
+
+    std::uint32_t anyone{0};
+    std::uint32_t everyone{~std::uint32_t{0}};
+    bool has_people{false};
+};
+
+//both parts in a single pass over the input, which can be fed in pieces
+class AnswersScanner
+{
+public:
+    //O(n) where n is the size of the piece
+    void scan(const char *first, const char *last)
+    {
+        for(; first != last; ++first)
         {
-            group << line;
+            const char c = *first;
+            if(c == '\n')
+            {
+                end_line(_person);
+                _person = 0;
+            }
+            else if('a' <= c && c <= 'z')
+            {
+                _person |= std::uint32_t{1} << (c - 'a');
+            }
         }
+    }
 
+    //a line without answers is blank and ends the group
+    void end_line(std::uint32_t person)
+    {
+        if(person == 0)
+            _group.close(_count);
+        else
+            _group.add_person(person);
     }
 
-    return groups;
+    //answers of the line that is not finished yet
+    std::uint32_t &pending_person()
+    {
+        return _person;
+    }
+
+    AnswersCount finish()
+    {
+        //the last person and group may not be followed by a new line
+        if(_person != 0)
+            _group.add_person(_person);
+        _person = 0;
+        _group.close(_count);
+        return _count;
+    }
+
+private:
+    AnswersCount _count;
+    GroupAnswers _group;
+    std::uint32_t _person{0};
+};
+
+using scan_kernel_t = void (*)(AnswersScanner &scanner, const char *first, const char *last);
+
+void scan_scalar(AnswersScanner &scanner, const char *first, const char *last)
+{
+    scanner.scan(first, last);
 }
 
-std::vector<int> check_answers_b(std::ifstream &ifs)
+#if defined(__x86_64__) || defined(__i386__)
+//one step of the segmented OR: each lane takes the lane shift positions
+//before it, unless a line starts in between
+__attribute__((target("avx2")))
+inline void scan_step(__m256i &x, __m256i &starts, __m256i shift, __m256i keep)
 {
-    std::string line;
-    std::ostringstream group;
-    std::vector<int> groups;
-    int ingroup_counter{};
+    const __m256i previous = _mm256_and_si256(_mm256_permutevar8x32_epi32(x, shift), keep);
+    const __m256i previous_starts = _mm256_and_si256(_mm256_permutevar8x32_epi32(starts, shift), keep);
+    x = _mm256_or_si256(x, _mm256_andnot_si256(starts, previous));
+    starts = _mm256_or_si256(starts, previous_starts);
+}
 
-    //O(n) where n is the number of lines
-    while(!ifs.eof())
+//Works on blocks of 32 characters. New lines are found with a vector compare
+//and every 8 characters are widened to 32 bits lanes where each letter
+//becomes its bit with a variable shift (anything that is not a letter
+//shifts out to 0). The OR of each line is a segmented prefix OR over the
+//lanes, restarting after each new line, so the lane holding a new line ends
+//up with the answers of the whole line. Only the per person AND and the
+//popcounts are left to the scalar code, once per line.
+__attribute__((target("avx2")))
+void scan_avx2(AnswersScanner &scanner, const char *first, const char *last)
+{
+    const __m256i new_line = _mm256_set1_epi8('\n');
+    const __m256i letter_a = _mm256_set1_epi32('a');
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i letters = _mm256_set1_epi32((1 << 26) - 1);
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    //lane i takes lane i - d, lanes below d are cleared by the keep masks
+    const __m256i shift_1 = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6);
+    const __m256i shift_2 = _mm256_setr_epi32(0, 0, 0, 1, 2, 3, 4, 5);
+    const __m256i shift_4 = _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 3);
+    const __m256i keep_1 = _mm256_setr_epi32(0, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i keep_2 = _mm256_setr_epi32(0, 0, -1, -1, -1, -1, -1, -1);
+    const __m256i keep_4 = _mm256_setr_epi32(0, 0, 0, 0, -1, -1, -1, -1);
+
+    std::uint32_t carry = scanner.pending_person();
+    std::uint32_t previous_new_line = 0;
+    alignas(32) std::uint32_t lines[32];
+
+    for(; last - first >= 32; first += 32)
     {
-        std::getline(ifs, line);
-        if(line.empty())
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+        std::uint32_t new_lines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, new_line));
+
+        for(int window = 0; window != 4; ++window)
         {
-            auto group_str = group.str();
-            std::array<int, 26> questions_tracker{0};
+            const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(first + 8 * window));
+            const __m256i positions = _mm256_sub_epi32(_mm256_cvtepu8_epi32(bytes), letter_a);
+            __m256i x = _mm256_and_si256(_mm256_sllv_epi32(one, positions), letters);
 
+            //lane i starts a line when the character before it is a new line
+            const std::uint32_t window_new_lines = (new_lines >> (8 * window)) & 0xff;
+            const std::uint32_t line_starts = ((window_new_lines << 1) | previous_new_line) & 0xff;
+            previous_new_line = window_new_lines >> 7;
+            __m256i starts = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(line_starts), lane_bits), lane_bits);
 
-            //O(m) where m is the number of answers per group
-            for(auto c : group_str)
-            {
-                //I'm assuming that we are using an ASCII table where all
-                //ASCII codes are sequential.
-                questions_tracker[c - 'a'] += 1;
-            }
+            scan_step(x, starts, shift_1, keep_1);
+            scan_step(x, starts, shift_2, keep_2);
+            scan_step(x, starts, shift_4, keep_4);
 
-            //O(1) since questions_tracker size is 26
-            auto total = std::count(std::begin(questions_tracker), std::end(questions_tracker), ingroup_counter);
-            groups.push_back(total);
+            //lanes still in the line that started in a previous window
+            x = _mm256_or_si256(x, _mm256_andnot_si256(starts, _mm256_set1_epi32(carry)));
 
-            //reset group
-            group.str("");
-            ingroup_counter = 0;
+            _mm256_store_si256(reinterpret_cast<__m256i *>(lines + 8 * window), x);
+            carry = previous_new_line ? 0 : lines[8 * window + 7];
         }
-        else
+
+        //O(number of lines in the block)
+        while(new_lines)
         {
-            group << line;
-            ++ingroup_counter;
+            scanner.end_line(lines[__builtin_ctz(new_lines)]);
+            new_lines &= new_lines - 1;
         }
-
     }
 
-    return groups;
+    scanner.pending_person() = carry;
+    scanner.scan(first, last);
+}
+#endif
+
+//chosen once at startup depending on what the cpu supports
+scan_kernel_t select_scan_kernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return scan_avx2;
+#endif
+    return scan_scalar;
+}
+
+AnswersCount check_answers(std::string_view input)
+{
+    AnswersScanner scanner;
+    select_scan_kernel()(scanner, input.data(), input.data() + input.size());
+    return scanner.finish();
 }
 
 int main(int argc, char *argv[])
 {
     assert(("expect input", argc == 2));
 
-    std::ifstream ifs{argv[1]};
+    std::ifstream ifs{argv[1], std::ios::binary};
+    const std::string input{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+
+    const auto count = check_answers(input);
 
     //part a
-    //auto groups = check_answers_a(ifs);
+    std::cout << count.anyone << '\n';
 
     //part b
-    auto groups = check_answers_b(ifs);
-
-    std::cout << std::accumulate(std::begin(groups), std::end(groups), 0) << '\n';
-
-
+    std::cout << count.everyone << '\n';
 
     return 0;
 }
@@ -2,123 +2,356 @@
 #include <fstream>
 #include <cassert>
 #include <string>
-#include <regex>
+#include <string_view>
 #include <iterator>
-#include <set>
-#include <map>
+#include <vector>
+#include <unordered_map>
+#include <optional>
+#include <numeric>
+#include <cstdint>
+#include <algorithm>
 
-//I'm assuming that there is no cycle. Some bags contain no bags and
-//it will be leaf nodes. Hence, the input file helps to create a DAG.
-struct Bag
+//Some bags contain no bags and they will be leaf nodes. The rules are
+//expected to form a DAG; cycles are detected and reported since the
+//number of bags inside a bag would be infinite.
+
+using color_id_t = std::uint32_t;
+
+//colour names are mapped to dense ids while parsing, so the graphs
+//can be indexed by id instead of being keyed by string. The names are
+//views into the input buffer, which has to outlive the interner
+class ColorInterner
 {
-    std::string color;
-    int quantity;
+public:
+    //O(1) on average
+    color_id_t intern(std::string_view color)
+    {
+        auto [it, inserted] = _ids.try_emplace(color, static_cast<color_id_t>(_names.size()));
+        if(inserted)
+            _names.push_back(color);
+        return it->second;
+    }
 
-    bool operator==(const Bag& other) const
+    std::optional<color_id_t> find(std::string_view color) const
     {
-        return color == other.color;
+        auto it = _ids.find(color);
+        if(it == std::cend(_ids))
+            return std::nullopt;
+        return it->second;
     }
 
-    bool operator==(const std::string& other) const
+    std::string_view name(color_id_t id) const
     {
-        return color == other;
+        return _names[id];
     }
 
-    bool operator<(const Bag& other) const
+    std::size_t size() const
     {
-        return color < other.color;
+        return _names.size();
     }
+
+private:
+    std::unordered_map<std::string_view, color_id_t> _ids;
+    std::vector<std::string_view> _names;
 };
 
-std::ostream& operator<<(std::ostream &os, Bag const& bag)
+//outer bag contains quantity inner bags
+struct Rule
 {
-    os << "Bag{" << bag.color << ", " << bag.quantity << '}';
-    return os;
-}
-
+    color_id_t outer;
+    color_id_t inner;
+    std::uint32_t quantity;
+};
 
-void find_bags(const std::string& bag_name, std::map<std::string, std::set<std::string>> const &bags, std::set<std::string> &all_bags)
+//compressed sparse rows: the neighbours of node n are in
+//[offsets[n], offsets[n+1]) of targets and quantities
+struct CsrGraph
 {
-    all_bags.insert(bag_name);
-    if(bags.find(bag_name) == std::cend(bags))
-        return;
+    //O(number of nodes + number of edges)
+    static CsrGraph build(std::size_t n_nodes, std::vector<Rule> const& rules)
+    {
+        CsrGraph graph;
+        graph.offsets.assign(n_nodes + 1, 0);
+        for(auto const& rule : rules)
+            ++graph.offsets[rule.outer + 1];
+
+        std::partial_sum(std::cbegin(graph.offsets), std::cend(graph.offsets), std::begin(graph.offsets));
 
-    for(auto outer_bag_name : bags.at(bag_name))
+        graph.targets.resize(rules.size());
+        graph.quantities.resize(rules.size());
+        std::vector<std::size_t> next{std::cbegin(graph.offsets), std::cend(graph.offsets) - 1};
+        for(auto const& rule : rules)
+        {
+            const auto position = next[rule.outer]++;
+            graph.targets[position] = rule.inner;
+            graph.quantities[position] = rule.quantity;
+        }
+
+        return graph;
+    }
+
+    std::size_t size() const
     {
-        find_bags(outer_bag_name, bags, all_bags);
+        return offsets.size() - 1;
     }
+
+    std::vector<std::size_t> offsets;
+    std::vector<color_id_t> targets;
+    std::vector<std::uint32_t> quantities;
 };
 
-int find_total_bags(Bag const& bag, std::map<std::string, std::set<Bag>> const &bags)
+//Scans "<colour> bags contain N <colour> bag(s), ... ." rules straight
+//from the input buffer into interned ids. Lines whose rule does not
+//follow this shape are reported and skipped.
+//O(n) where n is the input size
+void parse_rules(std::string_view input, ColorInterner &colors, std::vector<Rule> &rules)
 {
-    if(bags.find(bag.color) == std::cend(bags))
-        return 0;
+    constexpr std::string_view contain = " bags contain ";
+    constexpr std::string_view no_other_bags = "no other bags";
+    constexpr std::string_view bag = " bag";
 
-    int count = 0;
-    for(auto outer_bag : bags.at(bag.color))
+    std::size_t line_number = 0;
+    while(!input.empty())
     {
-        count += outer_bag.quantity;
-        count += outer_bag.quantity * find_total_bags(outer_bag, bags);
+        const auto line_end = std::min(input.find('\n'), input.size());
+        std::string_view line = input.substr(0, line_end);
+        input.remove_prefix(std::min(line_end + 1, input.size()));
+        ++line_number;
+
+        if(line.empty())
+            continue;
+
+        auto malformed = [&]
+        {
+            std::cerr << "skipping malformed rule at line " << line_number << '\n';
+        };
+
+        const auto contain_pos = line.find(contain);
+        if(contain_pos == std::string_view::npos) {
+            malformed();
+            continue;
+        }
+
+        const auto outer_bag = colors.intern(line.substr(0, contain_pos));
+        line.remove_prefix(contain_pos + contain.size());
+
+        if(line.substr(0, no_other_bags.size()) == no_other_bags)
+            continue; //since there are no other bags here
+
+        //one "N <colour> bag(s)" per iteration, separated by ", " and ended by '.'
+        while(!line.empty())
+        {
+            std::uint32_t quantity = 0;
+            std::size_t pos = 0;
+            while(pos != line.size() && '0' <= line[pos] && line[pos] <= '9')
+                quantity = quantity * 10 + (line[pos++] - '0');
+
+            const auto color_end = line.find(bag, pos);
+            if(pos == 0 || pos == line.size() || line[pos] != ' ' || color_end == std::string_view::npos) {
+                malformed();
+                break;
+            }
+
+            rules.push_back({outer_bag, colors.intern(line.substr(pos + 1, color_end - pos - 1)), quantity});
+
+            const auto separator = line.find_first_of(",.", color_end);
+            if(separator == std::string_view::npos || line[separator] == '.')
+                break;
+            line.remove_prefix(std::min(separator + 2, line.size()));
+        }
     }
+}
 
-    return count;
-};
+//build with -DBAG_COUNT_128 for rulebooks whose totals do not fit in 64 bits
+#ifdef BAG_COUNT_128
+using bag_count_t = unsigned __int128;
+#else
+using bag_count_t = std::uint64_t;
+#endif
 
+std::string to_string(bag_count_t value)
+{
+    std::string digits;
+    do {
+        digits.push_back(static_cast<char>('0' + value % 10));
+        value /= 10;
+    } while(value != 0);
+    return {std::crbegin(digits), std::crend(digits)};
+}
 
-int main(int argc, char *argv[])
+//Kahn's algorithm: a bag comes before every bag it contains. Returns
+//nothing if there is a cycle, since some bags never get to zero in-degree
+//O(number of nodes + number of edges)
+std::optional<std::vector<color_id_t>> topological_order(CsrGraph const& bags)
 {
-    assert(("expect input", argc == 2));
+    std::vector<std::size_t> in_degree(bags.size(), 0);
+    for(auto target : bags.targets)
+        ++in_degree[target];
 
-    std::ifstream ifs{argv[1]};
+    std::vector<color_id_t> order;
+    order.reserve(bags.size());
+    for(color_id_t bag = 0; bag != bags.size(); ++bag)
+    {
+        if(in_degree[bag] == 0)
+            order.push_back(bag);
+    }
 
-    std::regex pattern{R"(([\w ]+) bags contain no other bags\.|([\w ]+) bags contain ([\w ]+) bag| ([\w ]+) bag[s]?)"};
+    //order doubles as the queue
+    for(std::size_t head = 0; head != order.size(); ++head)
+    {
+        const auto bag = order[head];
+        for(auto i = bags.offsets[bag]; i != bags.offsets[bag + 1]; ++i)
+        {
+            if(--in_degree[bags.targets[i]] == 0)
+                order.push_back(bags.targets[i]);
+        }
+    }
 
-    std::map<std::string, std::set<std::string>> inverted_index_bags;
-    std::map<std::string, std::set<Bag>> bags;
+    if(order.size() != bags.size())
+        return std::nullopt;
 
-    std::string line;
-    //O(n) where n is the input size
-    while (std::getline(ifs, line)) {
+    return order;
+}
 
-        auto begin = std::sregex_iterator(std::begin(line),  std::end(line), pattern);
-        auto end = std::sregex_iterator();
-        std::smatch match = *begin;
+//number of bags inside each bag, computed once per bag from the leaves up
+//so shared sub-bags are not counted again for every path reaching them.
+//A total that does not fit in bag_count_t is left empty, and so is the
+//total of every bag carrying it, without affecting the other bags
+//O(number of nodes + number of edges)
+std::vector<std::optional<bag_count_t>> find_total_bags(CsrGraph const& bags, std::vector<color_id_t> const& order)
+{
+    std::vector<std::optional<bag_count_t>> total_bags(bags.size());
+    for(auto it = std::crbegin(order); it != std::crend(order); ++it)
+    {
+        const auto bag = *it;
+        bag_count_t count = 0;
+        bool overflow = false;
+        for(auto i = bags.offsets[bag]; i != bags.offsets[bag + 1] && !overflow; ++i)
+        {
+            //quantity * (the inner bag itself + what it carries)
+            auto const& inner_total = total_bags[bags.targets[i]];
+            bag_count_t inner;
+            overflow = !inner_total ||
+                __builtin_add_overflow(*inner_total, bag_count_t{1}, &inner) ||
+                __builtin_mul_overflow(inner, bag_count_t{bags.quantities[i]}, &inner) ||
+                __builtin_add_overflow(count, inner, &count);
+        }
+        if(!overflow)
+            total_bags[bag] = count;
+    }
 
-        //first group
-        if(!match[1].str().empty())
-            continue; //since there are no other bags here
+    return total_bags;
+}
 
-        //second group can have at least one bag
+//Answers, for any bag, how many bags can eventually contain it and how
+//many bags it carries, in O(1) after building it once per rulebook.
+//
+//The containers of a bag are its ancestors in the graph. They are found
+//with reachability bitsets propagated along the topological order, a batch
+//of source bags at a time so that memory stays at
+//O(number of nodes * BATCH_BITS / 8) bytes instead of quadratic.
+//Building takes O(number of nodes / BATCH_BITS * (number of nodes + number of edges) * BATCH_BITS / 64)
+class ContainmentIndex
+{
+public:
+    static constexpr std::size_t BATCH_WORDS = 64;
+    static constexpr std::size_t BATCH_BITS = BATCH_WORDS * 64;
 
-        // first bag that contain other bags
-        auto outer_bag = match[2].str();
-        // first bag within
-        auto insert = [&](std::string const& inner_bag)
+    ContainmentIndex(CsrGraph const& bags, std::vector<color_id_t> const& order, std::vector<std::optional<bag_count_t>> total_bags) :
+        _containers(bags.size(), 0), _total_bags{std::move(total_bags)}
+    {
+        std::vector<std::uint64_t> reachable(bags.size() * BATCH_WORDS);
+        for(std::size_t batch = 0; batch < bags.size(); batch += BATCH_BITS)
         {
-            auto space_pos = inner_bag.find(' ');
-            auto quantity = std::stoi(inner_bag.substr(0, space_pos));
-            inverted_index_bags[inner_bag.substr(space_pos+1)].insert(outer_bag);
-            bags[outer_bag].insert({inner_bag.substr(space_pos+1), quantity});
-        };
+            std::fill(std::begin(reachable), std::end(reachable), 0);
 
-        insert(match[3].str());
+            for(auto bag : order)
+            {
+                auto bits = std::begin(reachable) + bag * BATCH_WORDS;
+                const bool in_batch = batch <= bag && bag < batch + BATCH_BITS;
+                if(in_batch)
+                    bits[(bag - batch) / 64] |= std::uint64_t{1} << ((bag - batch) % 64);
 
-        ++begin; // search for other bags within
+                std::size_t count = 0;
+                for(std::size_t word = 0; word != BATCH_WORDS; ++word)
+                    count += __builtin_popcountll(bits[word]);
+                //a bag does not contain itself
+                _containers[bag] += count - in_batch;
 
-        //third group with the remaining bags
-        while(begin != end)
-        {
-            match = *begin++;
-            insert(match[4].str());
+                //every bag inside this one can be carried by whatever carries this one
+                for(auto i = bags.offsets[bag]; i != bags.offsets[bag + 1]; ++i)
+                {
+                    auto inner_bits = std::begin(reachable) + bags.targets[i] * BATCH_WORDS;
+                    for(std::size_t word = 0; word != BATCH_WORDS; ++word)
+                        inner_bits[word] |= bits[word];
+                }
+            }
         }
     }
 
-    std::set<std::string> all_bags;
-    //O(m) where m is the number of nodes in the graph
-    find_bags("shiny gold", inverted_index_bags, all_bags);
-    std::cout << "Total bags that can carry shiny gold: " << all_bags.size() - 1 << '\n';
-    //O(m) where m is the number of nodes in the graph
-    std::cout << "Total bags that shiny gold bags carry: " << find_total_bags({"shiny gold", 0}, bags) << '\n';
+    //how many different bags can eventually contain bag
+    std::size_t containers(color_id_t bag) const
+    {
+        return _containers[bag];
+    }
+
+    //how many bags bag carries, empty if it does not fit in bag_count_t
+    std::optional<bag_count_t> contents(color_id_t bag) const
+    {
+        return _total_bags[bag];
+    }
+
+private:
+    std::vector<std::size_t> _containers;
+    std::vector<std::optional<bag_count_t>> _total_bags;
+};
+
+
+int main(int argc, char *argv[])
+{
+    assert(("expect input, optionally followed by the colours to query", argc >= 2));
+
+    std::ifstream ifs{argv[1], std::ios::binary};
+
+    std::vector<std::string> queries{argv + 2, argv + argc};
+    if(queries.empty())
+        queries.push_back("shiny gold");
+
+    //the whole file is loaded at once, colour names point into it
+    const std::string input{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+
+    ColorInterner colors;
+    std::vector<Rule> rules;
+    parse_rules(input, colors, rules);
+
+    const auto bags = CsrGraph::build(colors.size(), rules);
+
+    const auto order = topological_order(bags);
+    if(!order)
+    {
+        std::cerr << "the rules have a cycle, bags would carry infinitely many bags\n";
+        return 1;
+    }
+
+    //O(m + e) where m is the number of nodes and e the number of edges in the graph
+    const ContainmentIndex index{bags, *order, find_total_bags(bags, *order)};
+
+    //O(1) per query
+    for(auto const& color : queries)
+    {
+        const auto bag = colors.find(color);
+        if(!bag)
+        {
+            std::cerr << "no rule mentions " << color << " bags\n";
+            continue;
+        }
+
+        std::cout << "Total bags that can carry " << color << ": " << index.containers(*bag) << '\n';
+        if(auto contents = index.contents(*bag))
+            std::cout << "Total bags that " << color << " bags carry: " << to_string(*contents) << '\n';
+        else
+            std::cerr << "total bags that " << color << " bags carry overflow, build with -DBAG_COUNT_128\n";
+    }
 
     return 0;
 }
@@ -3,136 +3,847 @@
 #include <cassert>
 #include <string>
 #include <vector>
-#include <set>
-#include <algorithm>
 #include <tuple>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <atomic>
+#include <mutex>
 #include <thread>
+#include <optional>
+#include <unordered_map>
+#include <charconv>
 #include <chrono>
+#include <limits>
 
-enum class OpCode {JMP, NOP, ACC};
+enum class OpCode : std::uint8_t {JMP, NOP, ACC};
 
+//the program is a packed array of these, the mnemonic is only
+//rebuilt from the opcode when printing
 struct Instruction
 {
-    Instruction(std::string const& name, int value): name{name}, value{value}
+    Instruction(OpCode op_code, std::int32_t value): value{value}, op_code{op_code}
+    {}
+
+    void swap_nop_jmp()
     {
-        if(name == "jmp")
+        if(op_code == OpCode::NOP)
             op_code = OpCode::JMP;
-        else if(name == "nop")
+        else if(op_code == OpCode::JMP)
             op_code = OpCode::NOP;
-        else //assuming it is acc
-            op_code = OpCode::ACC;
     }
 
-    void swap_nop_jmp()
+    const char *name() const
     {
-        if(op_code == OpCode::NOP){
-            op_code = OpCode::JMP;
-            name = "jmp";
-        } else if(op_code == OpCode::JMP){
-            op_code = OpCode::NOP;
-            name = "nop";
+        switch(op_code)
+        {
+        case OpCode::JMP: return "jmp";
+        case OpCode::NOP: return "nop";
+        case OpCode::ACC: return "acc";
         }
+        return "???";
     }
 
-    std::string name;
-    int value;
+    std::int32_t value;
     OpCode op_code;
-
 };
 
 std::ostream& operator<<(std::ostream &os, Instruction const& instruction)
 {
-    os << instruction.name << ' ' << instruction.value;
+    os << instruction.name() << ' ' << instruction.value;
     return os;
 }
 
-std::tuple<int, std::size_t> detect_loop(std::vector<Instruction> const& instructions)
+//Mnemonics are looked up in a table instead of being hardcoded in the
+//parser. A registered mnemonic lowers to one of the core opcodes, with its
+//operand multiplied by a factor, so the table can add spellings of jmp, nop
+//and acc without touching the interpreters, e.g. an acc with the operand
+//negated:
+//  table.register_opcode("sub", OpCode::ACC, -1);
+//Instructions with new semantics need a new OpCode and a handler in every
+//interpreter and in the optimiser.
+struct OpcodeDefinition
+{
+    OpCode op_code;
+    std::int32_t operand_factor;
+};
+
+class OpcodeTable
 {
-    int counter{};
-    std::vector<int> instructions_executed(instructions.size(), 0);
-    // assuming that no instruction will try to make sp less than 0
+public:
+    //returns false if the mnemonic was already registered
+    bool register_opcode(std::string const& mnemonic, OpCode op_code, std::int32_t operand_factor = 1)
+    {
+        return _definitions.try_emplace(mnemonic, OpcodeDefinition{op_code, operand_factor}).second;
+    }
+
+    std::optional<OpcodeDefinition> find(std::string const& mnemonic) const
+    {
+        auto it = _definitions.find(mnemonic);
+        if(it == std::cend(_definitions))
+            return std::nullopt;
+        return it->second;
+    }
+
+    static OpcodeTable console()
+    {
+        OpcodeTable table;
+        table.register_opcode("jmp", OpCode::JMP);
+        table.register_opcode("nop", OpCode::NOP);
+        table.register_opcode("acc", OpCode::ACC);
+        return table;
+    }
+
+private:
+    std::unordered_map<std::string, OpcodeDefinition> _definitions;
+};
+
+//"<mnemonic> <signed operand>" per line. Unknown mnemonics and malformed
+//operands are reported with their line number and reject the program
+//O(n) where n is the input size
+std::optional<std::vector<Instruction>> parse_program(std::istream &is, OpcodeTable const& table)
+{
+    std::vector<Instruction> instructions;
+    std::string line;
+    std::size_t line_number = 0;
+    while(std::getline(is, line))
+    {
+        ++line_number;
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if(line.empty())
+            continue;
+
+        const auto space = line.find(' ');
+        const std::string mnemonic{line.substr(0, space)};
+        const auto definition = table.find(mnemonic);
+        if(!definition)
+        {
+            std::cerr << "line " << line_number << ": unknown mnemonic " << mnemonic << '\n';
+            return std::nullopt;
+        }
+
+        //from_chars does not accept a leading +
+        const char *first = space == std::string::npos ? line.data() + line.size() : line.data() + space + 1;
+        const char *last = line.data() + line.size();
+        if(first != last && *first == '+')
+            ++first;
+        std::int32_t operand;
+        const auto [end, error] = std::from_chars(first, last, operand);
+        if(first == last || error != std::errc{} || end != last)
+        {
+            std::cerr << "line " << line_number << ": malformed operand in " << line << '\n';
+            return std::nullopt;
+        }
+
+        const std::int64_t value = std::int64_t{operand} * definition->operand_factor;
+        if(value < std::numeric_limits<std::int32_t>::min() || value > std::numeric_limits<std::int32_t>::max())
+        {
+            std::cerr << "line " << line_number << ": operand out of range in " << line << '\n';
+            return std::nullopt;
+        }
+
+        instructions.emplace_back(definition->op_code, static_cast<std::int32_t>(value));
+    }
+
+    return instructions;
+}
+
+//one bit per instruction, set once it has been executed
+class VisitedBitmap
+{
+public:
+    explicit VisitedBitmap(std::size_t size) : _words((size + 63) / 64, 0)
+    {}
+
+    //returns whether it was already set
+    bool test_and_set(std::size_t i)
+    {
+        const std::uint64_t bit = std::uint64_t{1} << (i % 64);
+        const bool was_set = _words[i / 64] & bit;
+        _words[i / 64] |= bit;
+        return was_set;
+    }
+
+    //O(size / 64), so a bitmap can be reused between runs without allocating
+    void clear()
+    {
+        std::fill(std::begin(_words), std::end(_words), 0);
+    }
+
+private:
+    std::vector<std::uint64_t> _words;
+};
+
+//why a run stopped
+enum class Termination : std::uint8_t
+{
+    END, //execution went right past the last instruction
+    LOOP, //an instruction was about to execute a second time
+    OUT_OF_BOUNDS //a jump left the program anywhere else
+};
+
+//Runs until an instruction is about to execute a second time or the
+//program stops. Returns the accumulator, where the instruction that
+//stopped it is (leading back into already executed code or out of the
+//program) or the program size when it ends, and why it stopped.
+//O(m) where m is the number of instructions since each
+//instruction can execute at most one time
+//visited must cover the program and be clear
+std::tuple<std::int64_t, std::size_t, Termination> detect_loop(std::vector<Instruction> const& instructions, VisitedBitmap &visited)
+{
+    const std::size_t size = instructions.size();
+    const Instruction *program = instructions.data();
+    std::int64_t counter{};
     std::size_t sp = 0;
-    // O(m) where m is the number of instructions since each
-    //instructions can execute at most one time
-    while(sp != instructions.size()) {
-        instructions_executed[sp]++;
-        auto instruction = instructions.at(sp);
+    std::size_t last = 0;
 
-        //std::cout << "Executing " << instruction << " at " << sp << '\n';
+#if defined(__GNUC__)
+    //computed goto: each instruction jumps straight to the handler of the
+    //next one instead of going back through a single switch
+    static void *const handlers[] = {&&op_jmp, &&op_nop, &&op_acc};
+#define DISPATCH() \
+    do { \
+        if(sp >= size || visited.test_and_set(sp)) goto done; \
+        last = sp; \
+        goto *handlers[static_cast<std::size_t>(program[sp].op_code)]; \
+    } while(false)
+
+    DISPATCH();
+op_jmp:
+    sp += program[sp].value;
+    DISPATCH();
+op_acc:
+    counter += program[sp].value;
+    ++sp;
+    DISPATCH();
+op_nop:
+    ++sp;
+    DISPATCH();
+#undef DISPATCH
+done:
+#else
+    while(sp < size && !visited.test_and_set(sp)) {
+        last = sp;
+        auto const& instruction = program[sp];
         switch(instruction.op_code)
             {
             case OpCode::JMP:
-                if(instructions_executed[sp + instruction.value] == 1)
-                    return std::make_tuple(counter, sp);
                 sp += instruction.value;
                 break;
             case OpCode::ACC:
                 counter += instruction.value;
+                [[fallthrough]];
             case OpCode::NOP:
                 ++sp;
                 break;
-            default:
-                std::cerr << "this is not suppose to happen\n";
             }
     }
+#endif
 
-    return std::make_tuple(counter, sp);
+    if(sp == size)
+        return std::make_tuple(counter, size, Termination::END);
+    return std::make_tuple(counter, last, sp > size ? Termination::OUT_OF_BOUNDS : Termination::LOOP);
 }
 
-int main(int argc, char *argv[])
+std::tuple<std::int64_t, std::size_t, Termination> detect_loop(std::vector<Instruction> const& instructions)
 {
-    assert(("expect input", argc == 2));
+    VisitedBitmap visited{instructions.size()};
+    return detect_loop(instructions, visited);
+}
 
-    std::ifstream ifs{argv[1]};
+//The peephole optimiser fuses each straight run of acc/nop into a single
+//acc carrying the summed operand, and folds a jmp ending the run into an
+//acc+jmp superinstruction. A run is cut wherever a jmp lands, so execution
+//can only enter a fused op at its start and a whole op runs at once; that
+//keeps loop detection exact with one visited bit per fused op. Jump targets
+//are resolved to fused op indices at compile time.
+enum class FusedOpCode : std::uint8_t {ACC, JMP, ACC_JMP};
 
-    std::vector<Instruction> instructions;
+struct FusedOp
+{
+    FusedOpCode op_code;
+    std::int64_t accumulator; //ACC and ACC_JMP
+    std::uint32_t target; //JMP and ACC_JMP, ops.size() + 1 when jumping out of the program
+    std::uint32_t last; //position of the last original instruction, for loop reports
+};
 
-    std::string line;
+struct OptimisedProgram
+{
+    std::vector<FusedOp> ops;
+    std::size_t original_size;
+};
 
-    //load instructions (we assume that everything is correct)
-    //O(n) where n is the input file size
-    while(std::getline(ifs, line))
+//O(n) where n is the number of instructions
+OptimisedProgram optimise(std::vector<Instruction> const& instructions)
+{
+    const std::size_t size = instructions.size();
+    std::vector<bool> is_target(size, false);
+    for(std::size_t i = 0; i != size; ++i)
+    {
+        const auto target = i + instructions[i].value;
+        if(instructions[i].op_code == OpCode::JMP && target < size)
+            is_target[target] = true;
+    }
+
+    OptimisedProgram program{{}, size};
+    std::vector<std::uint32_t> fused_index(size + 1, 0);
+    //original target of each jump, resolved once every fused index is known
+    std::vector<std::size_t> original_targets;
+
+    for(std::size_t i = 0; i != size;)
+    {
+        const auto start = i;
+        fused_index[start] = static_cast<std::uint32_t>(program.ops.size());
+
+        std::int64_t accumulator = 0;
+        while(i != size && instructions[i].op_code != OpCode::JMP && (i == start || !is_target[i]))
+        {
+            if(instructions[i].op_code == OpCode::ACC)
+                accumulator += instructions[i].value;
+            ++i;
+        }
+
+        if(i != size && instructions[i].op_code == OpCode::JMP && (i == start || !is_target[i]))
+        {
+            const auto op_code = i == start ? FusedOpCode::JMP : FusedOpCode::ACC_JMP;
+            program.ops.push_back({op_code, accumulator, 0, static_cast<std::uint32_t>(i)});
+            original_targets.push_back(i + instructions[i].value);
+            ++i;
+        }
+        else
+        {
+            program.ops.push_back({FusedOpCode::ACC, accumulator, 0, static_cast<std::uint32_t>(i - 1)});
+            original_targets.push_back(i);
+        }
+    }
+
+    const auto n_ops = static_cast<std::uint32_t>(program.ops.size());
+    fused_index[size] = n_ops;
+    for(std::size_t op = 0; op != n_ops; ++op)
+    {
+        const auto target = original_targets[op];
+        program.ops[op].target = target <= size ? fused_index[target] : n_ops + 1;
+    }
+
+    return program;
+}
+
+//same contract as detect_loop, over the fused ops
+//O(number of fused ops)
+std::tuple<std::int64_t, std::size_t, Termination> detect_loop(OptimisedProgram const& program, VisitedBitmap &visited)
+{
+    const std::size_t size = program.ops.size();
+    const FusedOp *ops = program.ops.data();
+    std::int64_t counter{};
+    std::size_t pc = 0;
+    std::size_t last = 0;
+
+#if defined(__GNUC__)
+    static void *const handlers[] = {&&op_acc, &&op_jmp, &&op_acc_jmp};
+#define DISPATCH() \
+    do { \
+        if(pc >= size || visited.test_and_set(pc)) goto done; \
+        last = ops[pc].last; \
+        goto *handlers[static_cast<std::size_t>(ops[pc].op_code)]; \
+    } while(false)
+
+    DISPATCH();
+op_acc:
+    counter += ops[pc].accumulator;
+    ++pc;
+    DISPATCH();
+op_jmp:
+    pc = ops[pc].target;
+    DISPATCH();
+op_acc_jmp:
+    counter += ops[pc].accumulator;
+    pc = ops[pc].target;
+    DISPATCH();
+#undef DISPATCH
+done:
+#else
+    while(pc < size && !visited.test_and_set(pc)) {
+        last = ops[pc].last;
+        auto const& op = ops[pc];
+        switch(op.op_code)
+            {
+            case FusedOpCode::ACC:
+                counter += op.accumulator;
+                ++pc;
+                break;
+            case FusedOpCode::JMP:
+                pc = op.target;
+                break;
+            case FusedOpCode::ACC_JMP:
+                counter += op.accumulator;
+                pc = op.target;
+                break;
+            }
+    }
+#endif
+
+    if(pc == size)
+        return std::make_tuple(counter, program.original_size, Termination::END);
+    return std::make_tuple(counter, last, pc > size ? Termination::OUT_OF_BOUNDS : Termination::LOOP);
+}
+
+std::tuple<std::int64_t, std::size_t, Termination> detect_loop(OptimisedProgram const& program)
+{
+    VisitedBitmap visited{program.ops.size()};
+    return detect_loop(program, visited);
+}
+
+//runs the program rounds times before and after the optimiser. The visited
+//bitmap is allocated once and cleared between runs, so only dispatch is timed
+void report_optimiser(std::vector<Instruction> const& instructions, int rounds)
+{
+    using clock = std::chrono::steady_clock;
+    auto time = [rounds](auto const& program, std::size_t size)
+    {
+        VisitedBitmap visited{size};
+        auto result = detect_loop(program, visited);
+        const auto start = clock::now();
+        for(int round = 0; round != rounds; ++round)
+        {
+            visited.clear();
+            result = detect_loop(program, visited);
+        }
+        const std::chrono::duration<double, std::milli> elapsed = clock::now() - start;
+        return std::make_tuple(result, elapsed.count());
+    };
+
+    const auto compile_start = clock::now();
+    const auto program = optimise(instructions);
+    const std::chrono::duration<double, std::milli> compile_time = clock::now() - compile_start;
+
+    const auto [before, before_ms] = time(instructions, instructions.size());
+    const auto [after, after_ms] = time(program, program.ops.size());
+
+    std::cout << "Optimiser: " << instructions.size() << " instructions -> " << program.ops.size()
+              << " ops in " << compile_time.count() << " ms\n";
+    std::cout << "Before: " << before_ms << " ms for " << rounds << " runs\n";
+    std::cout << "After: " << after_ms << " ms for " << rounds << " runs (" << before_ms / after_ms << "x)\n";
+    if(before != after)
+        std::cerr << "the optimised program does not behave like the original\n";
+}
+
+//where execution goes after instruction i, the program size meaning it ended
+std::size_t next_sp(std::vector<Instruction> const& instructions, std::size_t i, OpCode op_code)
+{
+    return op_code == OpCode::JMP ? i + instructions[i].value : i + 1;
+}
+
+//flipping the jmp or nop at position makes the program end with accumulator
+struct Repair
+{
+    std::size_t position;
+    std::int64_t accumulator;
+};
+
+//Finds every single jmp/nop flip that makes the program end, in O(n) total:
+//
+//1. walking the control flow graph backwards from the end marks the
+//   instructions that reach it, together with what they add to the
+//   accumulator on the way there;
+//2. walking the original execution path, a flip repairs the program when
+//   the instruction it now leads to reaches the end.
+//
+//The flipped instruction cannot be on the way from its new target to the
+//end: it is on the original path, which never reaches the end.
+std::vector<Repair> find_repairs(std::vector<Instruction> const& instructions)
+{
+    const std::size_t size = instructions.size();
+
+    //predecessors in compressed sparse rows, the end is node size
+    std::vector<std::size_t> offsets(size + 2, 0);
+    for(std::size_t i = 0; i != size; ++i)
+    {
+        const auto next = next_sp(instructions, i, instructions[i].op_code);
+        if(next <= size)
+            ++offsets[next + 1];
+    }
+    for(std::size_t i = 1; i != offsets.size(); ++i)
+        offsets[i] += offsets[i - 1];
+
+    std::vector<std::size_t> predecessors(offsets.back());
+    std::vector<std::size_t> fill{std::cbegin(offsets), std::cend(offsets) - 1};
+    for(std::size_t i = 0; i != size; ++i)
+    {
+        const auto next = next_sp(instructions, i, instructions[i].op_code);
+        if(next <= size)
+            predecessors[fill[next]++] = i;
+    }
+
+    //O(n): each instruction has a single successor so it is reached at most once
+    std::vector<bool> reaches_end(size + 1, false);
+    std::vector<std::int64_t> accumulator_to_end(size + 1, 0);
+    std::vector<std::size_t> pending{size};
+    reaches_end[size] = true;
+    while(!pending.empty())
+    {
+        const auto node = pending.back();
+        pending.pop_back();
+        for(auto i = offsets[node]; i != offsets[node + 1]; ++i)
+        {
+            const auto predecessor = predecessors[i];
+            reaches_end[predecessor] = true;
+            accumulator_to_end[predecessor] = accumulator_to_end[node] +
+                (instructions[predecessor].op_code == OpCode::ACC ? instructions[predecessor].value : 0);
+            pending.push_back(predecessor);
+        }
+    }
+
+    //nothing to repair if the program already ends
+    std::vector<Repair> repairs;
+    if(reaches_end[0])
+        return repairs;
+
+    //O(n): the original path visits each instruction at most once
+    VisitedBitmap visited{size};
+    std::int64_t counter{};
+    for(std::size_t sp = 0; sp < size && !visited.test_and_set(sp);)
+    {
+        auto const& instruction = instructions[sp];
+        if(instruction.op_code != OpCode::ACC)
+        {
+            const auto flipped = next_sp(instructions, sp, instruction.op_code == OpCode::JMP ? OpCode::NOP : OpCode::JMP);
+            if(flipped <= size && reaches_end[flipped])
+                repairs.push_back({sp, counter + accumulator_to_end[flipped]});
+        }
+
+        if(instruction.op_code == OpCode::ACC)
+            counter += instruction.value;
+        sp = next_sp(instructions, sp, instruction.op_code);
+    }
+
+    return repairs;
+}
+
+//Speculative patch search, for repair policies where no linear algorithm
+//exists. Every candidate is a small set of patches that is run on its own,
+//on a thread pool; each worker applies the patches to a private copy of the
+//program and reverts them afterwards, so the shared instructions are never
+//touched and every run has its own visited bitmap.
+//
+//A policy enumerates candidates by index so workers can claim chunks of them:
+//  std::optional<std::size_t> size() const     number of candidates, nothing if it does not fit
+//  State unrank(std::size_t index) const       state of the index-th candidate
+//  void advance(State &state) const            state of the next candidate
+//  void patches(State const&, Candidate &) const
+
+//replaces the instruction at position
+struct Patch
+{
+    std::size_t position;
+    Instruction instruction;
+};
+
+using Candidate = std::vector<Patch>;
+
+struct PatchResult
+{
+    std::size_t index;
+    Candidate patches;
+    std::int64_t accumulator;
+};
+
+//flips k different jmp/nop instructions, candidates are the k-combinations
+//of those instructions in lexicographic order
+class FlipPolicy
+{
+public:
+    using State = std::vector<std::size_t>;
+
+    FlipPolicy(std::vector<Instruction> const& instructions, std::size_t k) : _instructions{instructions}, _k{k}
+    {
+        for(std::size_t i = 0; i != instructions.size(); ++i)
+            if(instructions[i].op_code != OpCode::ACC)
+                _flippable.push_back(i);
+        _size = binomial(_flippable.size(), _k);
+    }
+
+    std::optional<std::size_t> size() const
+    {
+        return _size;
+    }
+
+    //O(number of flippable instructions * k)
+    State unrank(std::size_t index) const
+    {
+        State state;
+        std::size_t candidate = 0;
+        for(std::size_t slot = 0; slot != _k; ++slot, ++candidate)
+        {
+            //skip the combinations starting with smaller instructions
+            for(;; ++candidate)
+            {
+                //never overflows when the total fits, its intermediate products are smaller
+                const auto with_candidate = *binomial(_flippable.size() - candidate - 1, _k - slot - 1);
+                if(index < with_candidate)
+                    break;
+                index -= with_candidate;
+            }
+            state.push_back(candidate);
+        }
+        return state;
+    }
+
+    //O(k)
+    void advance(State &state) const
+    {
+        std::size_t slot = _k;
+        while(slot != 0 && state[slot - 1] == _flippable.size() - _k + slot - 1)
+            --slot;
+        if(slot == 0)
+            return; //that was the last combination
+        ++state[slot - 1];
+        for(; slot != _k; ++slot)
+            state[slot] = state[slot - 1] + 1;
+    }
+
+    void patches(State const& state, Candidate &candidate) const
+    {
+        candidate.clear();
+        for(auto i : state)
+        {
+            Instruction flipped = _instructions[_flippable[i]];
+            flipped.swap_nop_jmp();
+            candidate.push_back({_flippable[i], flipped});
+        }
+    }
+
+private:
+    //nothing when an intermediate product does not fit
+    static std::optional<std::size_t> binomial(std::size_t n, std::size_t k)
+    {
+        if(k > n)
+            return 0;
+        std::size_t result = 1;
+        for(std::size_t i = 1; i <= k; ++i)
+        {
+            if(__builtin_mul_overflow(result, n - k + i, &result))
+                return std::nullopt;
+            result /= i;
+        }
+        return result;
+    }
+
+    std::vector<Instruction> const& _instructions;
+    std::size_t _k;
+    std::vector<std::size_t> _flippable;
+    std::optional<std::size_t> _size;
+};
+
+//adds a delta in [min_delta, max_delta] to the operand of one jmp. acc
+//operands are left alone since they never change where execution goes, so
+//they cannot make a looping program end
+class OperandPolicy
+{
+public:
+    using State = std::size_t;
+
+    OperandPolicy(std::vector<Instruction> const& instructions, std::int32_t min_delta, std::int32_t max_delta) :
+        _instructions{instructions}, _min_delta{min_delta},
+        _deltas{static_cast<std::size_t>(std::int64_t{max_delta} - min_delta + 1)}
+    {
+        for(std::size_t i = 0; i != instructions.size(); ++i)
+            if(instructions[i].op_code == OpCode::JMP)
+                _jumps.push_back(i);
+    }
+
+    std::optional<std::size_t> size() const
+    {
+        std::size_t size;
+        if(__builtin_mul_overflow(_jumps.size(), _deltas, &size))
+            return std::nullopt;
+        return size;
+    }
+
+    State unrank(std::size_t index) const
+    {
+        return index;
+    }
+
+    void advance(State &state) const
+    {
+        ++state;
+    }
+
+    void patches(State const& state, Candidate &candidate) const
+    {
+        candidate.clear();
+        const auto position = _jumps[state / _deltas];
+        const auto delta = _min_delta + static_cast<std::int64_t>(state % _deltas);
+        const auto value = _instructions[position].value + delta;
+        if(delta == 0)
+            return; //that is the original program
+        if(value < std::numeric_limits<std::int32_t>::min() || value > std::numeric_limits<std::int32_t>::max())
+            return; //not an operand the console can hold
+        Instruction patched = _instructions[position];
+        patched.value = static_cast<std::int32_t>(value);
+        candidate.push_back({position, patched});
+    }
+
+private:
+    std::vector<Instruction> const& _instructions;
+    std::int64_t _min_delta;
+    std::size_t _deltas;
+    std::vector<std::size_t> _jumps;
+};
+
+//runs every candidate of the policy and returns the ones that make the
+//program end, sorted by candidate index. The policy size must fit
+//O(number of candidates * n / number of threads)
+template<typename Policy>
+std::vector<PatchResult> speculative_search(std::vector<Instruction> const& instructions, Policy const& policy,
+                                            std::size_t n_threads = std::thread::hardware_concurrency())
+{
+    constexpr std::size_t CHUNK = 64;
+    const std::size_t n_candidates = *policy.size();
+    std::atomic<std::size_t> next_chunk{0};
+    std::mutex results_mutex;
+    std::vector<PatchResult> results;
+
+    auto worker = [&]
+    {
+        std::vector<Instruction> program = instructions;
+        std::vector<PatchResult> found;
+        Candidate candidate;
+        for(std::size_t begin; (begin = next_chunk.fetch_add(CHUNK)) < n_candidates;)
         {
-            const std::string name{line.substr(0, 3)};
-            //not checking for std::invalid_argument or std::out_of_range exceptions
-            const int value = std::stoi(line.substr(4));
+            const auto end = std::min(begin + CHUNK, n_candidates);
+            auto state = policy.unrank(begin);
+            for(std::size_t index = begin; index != end; ++index)
+            {
+                policy.patches(state, candidate);
+                for(auto const& patch : candidate)
+                    program[patch.position] = patch.instruction;
+
+                const auto [counter, sp, termination] = detect_loop(program);
+                if(termination == Termination::END && !candidate.empty())
+                    found.push_back({index, candidate, counter});
 
-            instructions.emplace_back(name, value);
+                for(auto const& patch : candidate)
+                    program[patch.position] = instructions[patch.position];
+                policy.advance(state);
+            }
         }
 
+        std::lock_guard<std::mutex> lock{results_mutex};
+        std::move(std::begin(found), std::end(found), std::back_inserter(results));
+    };
+
+    std::vector<std::thread> pool;
+    for(std::size_t i = 0; i != std::max<std::size_t>(n_threads, 1); ++i)
+        pool.emplace_back(worker);
+    for(auto &thread : pool)
+        thread.join();
+
+    std::sort(std::begin(results), std::end(results),
+              [](PatchResult const& a, PatchResult const& b) { return a.index < b.index; });
+    return results;
+}
+
+void print_patch_results(std::vector<PatchResult> const& results, std::vector<Instruction> const& instructions)
+{
+    for(auto const& result : results)
+    {
+        std::cout << "Program ends with counter " << result.accumulator << " patching";
+        for(auto const& patch : result.patches)
+            std::cout << ' ' << patch.position << " (" << instructions[patch.position] << " -> " << patch.instruction << ')';
+        std::cout << '\n';
+    }
+    std::cout << results.size() << " repairs found\n";
+}
+
+//refuses policies with more candidates than can be counted
+//returns false if the search did not run
+template<typename Policy>
+bool run_policy(std::vector<Instruction> const& instructions, Policy const& policy)
+{
+    if(!policy.size())
+    {
+        std::cerr << "the policy has too many candidates\n";
+        return false;
+    }
+    print_patch_results(speculative_search(instructions, policy), instructions);
+    return true;
+}
+
+//usage: input [flip <k> | operand <min delta> <max delta> | report <rounds>]
+//the optional policy runs a parallel speculative search after both parts,
+//report times the program before and after the peephole optimiser
+int main(int argc, char *argv[])
+{
+    assert(("expect input, optionally followed by a repair policy", argc == 2 || argc == 4 || argc == 5));
+
+    std::ifstream ifs{argv[1]};
+
+    //O(n) where n is the input file size
+    const auto program = parse_program(ifs, OpcodeTable::console());
+    if(!program)
+        return 1;
+
+    const auto& instructions = *program;
+
     //part a
-    auto result = detect_loop(instructions);
+    const auto [counter, sp, termination] = detect_loop(instructions);
     std::cout << "Part 1\n";
-    std::cout << "Counter before loop: " << std::get<0>(result) << "" << '\n';
-    if(std::get<1>(result) != instructions.size())
-        std::cout << "Loop found at " << std::get<1>(result) << '\n';
-    else
+    std::cout << "Counter before loop: " << counter << "" << '\n';
+    switch(termination)
+    {
+    case Termination::LOOP:
+        std::cout << "Loop found at " << sp << '\n';
+        break;
+    case Termination::OUT_OF_BOUNDS:
+        std::cout << "Jump out of the program at " << sp << '\n';
+        break;
+    case Termination::END:
         std::cout << "No loop found\n";
+        break;
+    }
 
     //part b
     std::cout << "Part 2\n";
-    //O(n^2) where n is the number of instructions since we can have all instructions as jmp or nop
+    //O(n) where n is the number of instructions
+    const auto repairs = find_repairs(instructions);
+    for(auto const& repair : repairs)
     {
-        for(std::size_t i = 0; i != instructions.size(); ++i)
-            {
-                if(instructions.at(i).op_code == OpCode::ACC)
-                    continue;
-
-                instructions.at(i).swap_nop_jmp();
-                result = detect_loop(instructions);
-                instructions.at(i).swap_nop_jmp();
-                if(std::get<1>(result) == instructions.size()) {
-                    std::cout << "Loop found at " << i << " in a " << instructions.at(i) <<'\n';
-                    break;
-                }
-            }
+        std::cout << "Loop found at " << repair.position << " in a " << instructions[repair.position] << '\n';
+        std::cout << "Counter before loop: " << repair.accumulator << "" << '\n';
     }
 
-    std::cout << "Counter before loop: " << std::get<0>(result) << "" << '\n';
-    if(std::get<1>(result) != instructions.size())
-        std::cout << "Loop found at " << std::get<1>(result) << '\n';
+    if(repairs.empty())
+        std::cout << "No repair found\n";
     else
         std::cout << "No loop found\n";
 
+    if(argc > 2)
+    {
+        const std::string option{argv[2]};
+        if(option == "flip" && argc == 4)
+        {
+            if(!run_policy(instructions, FlipPolicy{instructions, std::stoul(argv[3])}))
+                return 1;
+        }
+        else if(option == "report" && argc == 4)
+            report_optimiser(instructions, std::stoi(argv[3]));
+        else if(option == "operand" && argc == 5)
+        {
+            const auto min_delta = std::stoi(argv[3]);
+            const auto max_delta = std::stoi(argv[4]);
+            if(min_delta > max_delta)
+            {
+                std::cerr << "the minimum delta " << min_delta << " is above the maximum " << max_delta << '\n';
+                return 1;
+            }
+            if(!run_policy(instructions, OperandPolicy{instructions, min_delta, max_delta}))
+                return 1;
+        }
+        else
+            std::cerr << "unknown option " << option << '\n';
+    }
+
     return 0;
 }
@@ -3,83 +3,336 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
-#include <list>
-#include <unordered_set>
-#include <algorithm>
-#include <tuple>
+#include <vector>
+#include <unordered_map>
+#include <deque>
+#include <optional>
+#include <cstdlib>
 
-const int PREAMBLE = 25;
+const std::size_t DEFAULT_PREAMBLE = 25;
+//up to this size a window is checked by comparing every pair in place,
+//which beats hashing when there are only a few hundred pairs
+const std::size_t SMALL_PREAMBLE = 32;
 
-//O(n): similar to day 1 problem. Use a set to find if a number is the sum of two numbers in a container
-bool its_sum_is_in_previous_numbers(std::size_t next_number, std::list<std::size_t> const& numbers)
+//The last PREAMBLE numbers live in a ring buffer and the sums of every
+//pair of them (with different values) are kept in a counted hash set.
+//Pushing a number adds its sums with the ones in the window and evicting
+//the oldest removes its sums, so each step is O(window) hash updates
+//instead of rebuilding a set of the whole window per number.
+class XmasWindow
 {
-    auto first = std::begin(numbers);
-    auto last = std::begin(numbers);
-    std::advance(last, PREAMBLE + 1);
-    const std::unordered_set<std::size_t> s{first, last};
+public:
+    explicit XmasWindow(std::size_t preamble) : _numbers(preamble, 0)
+    {}
 
-    for(auto current: s)
+    bool full() const
     {
-        auto candidate = next_number - current;
-        if(candidate != current && s.find(candidate) != std::cend(s)){
-            return true;
+        return _size == _numbers.size();
+    }
+
+    //O(1) on average
+    bool contains_pair_sum(std::size_t number) const
+    {
+        return _pair_sums.find(number) != std::cend(_pair_sums);
+    }
+
+    //adds number, evicting the oldest one if the window is full
+    //O(window)
+    void push(std::size_t number)
+    {
+        if(!full())
+        {
+            for(std::size_t i = 0; i != _size; ++i)
+                add_sum(number, _numbers[i]);
+            _numbers[_size++] = number;
+            return;
+        }
+
+        const auto oldest = _numbers[_head];
+        for(std::size_t i = 0; i != _numbers.size(); ++i)
+        {
+            if(i != _head)
+            {
+                remove_sum(oldest, _numbers[i]);
+                add_sum(number, _numbers[i]);
+            }
         }
+
+        _numbers[_head] = number;
+        _head = (_head + 1) % _numbers.size();
     }
 
+private:
+    //only pairs of different numbers count
+    void add_sum(std::size_t a, std::size_t b)
+    {
+        if(a != b)
+            ++_pair_sums[a + b];
+    }
+
+    void remove_sum(std::size_t a, std::size_t b)
+    {
+        if(a == b)
+            return;
+        auto it = _pair_sums.find(a + b);
+        if(--it->second == 0)
+            _pair_sums.erase(it);
+    }
+
+    std::vector<std::size_t> _numbers;
+    std::size_t _head{}; //slot of the oldest number once the window is full
+    std::size_t _size{};
+    std::unordered_map<std::size_t, std::size_t> _pair_sums;
+};
+
+//whether number is the sum of two different numbers of window[0, preamble)
+//O(preamble^2) but without any allocation or hashing
+inline bool is_pair_sum(const std::size_t *window, std::size_t preamble, std::size_t number)
+{
+    for(std::size_t i = 0; i != preamble; ++i)
+    {
+        for(std::size_t j = i + 1; j != preamble; ++j)
+        {
+            if(window[i] != window[j] && window[i] + window[j] == number)
+                return true;
+        }
+    }
     return false;
 }
 
+//same with a window size known at compile time, so the loops are unrolled
+template<std::size_t Preamble>
+bool is_pair_sum_fixed(const std::size_t *window, std::size_t, std::size_t number)
+{
+    return is_pair_sum(window, Preamble, number);
+}
 
-//O(n)
-std::tuple<std::size_t, std::size_t> bounds_of_sum_of_sequence(std::list<std::size_t> numbers, std::size_t number) {
-    //find contiguous sequeuence in numbers that when added up result into "number"
-    //returns the smallest and largest of this sequence
-    auto top_it = std::begin(numbers);
-    auto current_number_it = std::begin(numbers);
-    std::size_t accumulator{};
-
-    while(accumulator != number && current_number_it != std::cend(numbers) && *current_number_it < number) {
-        accumulator += *current_number_it++;
-        while(accumulator > number) {
-            accumulator -= *top_it++;
+using pair_sum_kernel_t = bool (*)(const std::size_t *window, std::size_t preamble, std::size_t number);
+
+//small windows are read straight from the numbers, nullptr means the
+//window is too large and needs an XmasWindow
+pair_sum_kernel_t select_pair_sum_kernel(std::size_t preamble)
+{
+    switch(preamble)
+    {
+    case 5:
+        return is_pair_sum_fixed<5>;
+    case DEFAULT_PREAMBLE:
+        return is_pair_sum_fixed<DEFAULT_PREAMBLE>;
+    }
+    return preamble <= SMALL_PREAMBLE ? is_pair_sum : nullptr;
+}
+
+//first number that is not the sum of two of the preamble numbers before
+//it, for several preamble sizes at once so the numbers are read in a
+//single pass. A size stops being checked once its answer is known.
+//An empty preamble has no pairs, so its answer is the first number.
+//O(n * sum of preamble sizes) for windows over SMALL_PREAMBLE
+std::vector<std::optional<std::size_t>> find_invalid_numbers(std::vector<std::size_t> const& numbers,
+                                                              std::vector<std::size_t> const& preambles)
+{
+    struct Scan
+    {
+        std::size_t preamble;
+        pair_sum_kernel_t is_pair_sum;
+        std::optional<XmasWindow> window;
+        bool done;
+    };
+
+    std::vector<Scan> scans;
+    scans.reserve(preambles.size());
+    for(auto preamble : preambles)
+    {
+        const auto kernel = select_pair_sum_kernel(preamble);
+        scans.push_back({preamble, kernel, kernel ? std::nullopt : std::make_optional<XmasWindow>(preamble), false});
+    }
+
+    std::vector<std::optional<std::size_t>> invalid_numbers(preambles.size());
+    std::size_t pending = scans.size();
+    for(std::size_t i = 0; i != numbers.size() && pending != 0; ++i)
+    {
+        const auto number = numbers[i];
+        for(std::size_t s = 0; s != scans.size(); ++s)
+        {
+            auto &scan = scans[s];
+            if(scan.done)
+                continue;
+
+            bool valid = true;
+            if(scan.window)
+            {
+                valid = !scan.window->full() || scan.window->contains_pair_sum(number);
+                scan.window->push(number);
+            }
+            else if(i >= scan.preamble)
+            {
+                valid = scan.is_pair_sum(numbers.data() + i - scan.preamble, scan.preamble, number);
+            }
+
+            if(!valid)
+            {
+                invalid_numbers[s] = number;
+                scan.done = true;
+                --pending;
+            }
         }
     }
 
-    auto smallest = std::min_element(top_it, current_number_it);
-    auto largest = std::max_element(top_it, current_number_it);
-    return std::make_tuple(*smallest, *largest);
+    return invalid_numbers;
 }
 
+std::optional<std::size_t> find_invalid_number(std::vector<std::size_t> const& numbers, std::size_t preamble = DEFAULT_PREAMBLE)
+{
+    return find_invalid_numbers(numbers, {preamble}).front();
+}
+
+
+//a contiguous range [first, last) of the numbers and its smallest and largest number
+struct SumRange
+{
+    std::size_t first;
+    std::size_t last;
+    std::size_t smallest;
+    std::size_t largest;
+};
+
+//Calls on_range for every contiguous range of at least two numbers adding
+//up to target, in order of their last number, until it returns false.
+//
+//The window [left, right) is slid over the numbers and its sum is the
+//difference of the prefix sums at both ends, which only grow since numbers
+//are unsigned. The smallest and largest number of the window come from two
+//monotonic deques of indices, so they are known without scanning the range.
+//O(n) plus the number of ranges reported
+template<typename OnRange>
+void for_each_sum_range(std::vector<std::size_t> const& numbers, std::size_t target, OnRange on_range)
+{
+    std::deque<std::size_t> smallest; //increasing numbers
+    std::deque<std::size_t> largest; //decreasing numbers
+    std::size_t prefix_left{};
+    std::size_t prefix_right{};
+    std::size_t left{};
+
+    //first deque entry still inside a window starting at start
+    const auto front_from = [](std::deque<std::size_t> const& indices, std::size_t start)
+    {
+        auto it = std::cbegin(indices);
+        while(*it < start)
+            ++it;
+        return *it;
+    };
+
+    for(std::size_t right = 0; right != numbers.size(); ++right)
+    {
+        const auto number = numbers[right];
+        prefix_right += number;
+        while(!smallest.empty() && numbers[smallest.back()] >= number)
+            smallest.pop_back();
+        smallest.push_back(right);
+        while(!largest.empty() && numbers[largest.back()] <= number)
+            largest.pop_back();
+        largest.push_back(right);
+
+        while(prefix_right - prefix_left > target)
+        {
+            prefix_left += numbers[left++];
+            if(smallest.front() < left)
+                smallest.pop_front();
+            if(largest.front() < left)
+                largest.pop_front();
+        }
+
+        //zeros at the start of the window give more ranges with the same sum
+        for(std::size_t start = left; start < right && prefix_right - prefix_left == target; ++start)
+        {
+            const SumRange range{start, right + 1, numbers[front_from(smallest, start)], numbers[front_from(largest, start)]};
+            if(!on_range(range))
+                return;
+            if(numbers[start] != 0)
+                break;
+        }
+    }
+}
+
+//O(n)
+std::optional<SumRange> find_sum_range(std::vector<std::size_t> const& numbers, std::size_t target)
+{
+    std::optional<SumRange> found;
+    for_each_sum_range(numbers, target, [&found](SumRange const& range)
+    {
+        found = range;
+        return false;
+    });
+    return found;
+}
+
+//O(n + number of ranges)
+std::vector<SumRange> find_all_sum_ranges(std::vector<std::size_t> const& numbers, std::size_t target)
+{
+    std::vector<SumRange> ranges;
+    for_each_sum_range(numbers, target, [&ranges](SumRange const& range)
+    {
+        ranges.push_back(range);
+        return true;
+    });
+    return ranges;
+}
+
+//usage: input [preamble...]
+//every preamble size is checked in the same pass over the numbers
 int main(int argc, char *argv[])
 {
-    assert(("expect input", argc == 2));
+    assert(("expect input, optionally followed by preamble sizes", argc >= 2));
+
+    std::vector<std::size_t> preambles;
+    for(int i = 2; i < argc; ++i)
+    {
+        const long preamble = std::atol(argv[i]);
+        if(preamble <= 0)
+        {
+            std::cerr << "invalid preamble size " << argv[i] << '\n';
+            return 1;
+        }
+        preambles.push_back(preamble);
+    }
+    if(preambles.empty())
+        preambles.push_back(DEFAULT_PREAMBLE);
 
     std::ifstream ifs{argv[1]};
 
-    std::list<std::size_t> numbers;
+    std::vector<std::size_t> numbers;
 
     std::size_t number;
     while(ifs >> number) {
         numbers.push_back(number);
     }
 
-    auto numbers_copy = numbers;
-    auto current_it = std::cbegin(numbers_copy);
-    std::advance(current_it, PREAMBLE + 1);
-
-    while(its_sum_is_in_previous_numbers(*current_it, numbers_copy) && current_it != std::cend(numbers_copy))
+    const auto invalid_numbers = find_invalid_numbers(numbers, preambles);
+    for(std::size_t i = 0; i != preambles.size(); ++i)
     {
-        numbers_copy.pop_front();
-        current_it = std::next(current_it);
-    }
+        if(preambles.size() > 1)
+            std::cout << "Preamble " << preambles[i] << '\n';
 
-    std::cout << "Not sum of previous numbers " << *current_it << '\n';
+        const auto invalid_number = invalid_numbers[i];
+        if(!invalid_number)
+        {
+            std::cout << "All numbers are sums of previous numbers\n";
+            continue;
+        }
 
-    auto [smallest, largest] = bounds_of_sum_of_sequence(numbers, *current_it);
+        std::cout << "Not sum of previous numbers " << *invalid_number << '\n';
 
-    std::cout << "smallest " << smallest << ", largest " << largest << '\n';
-    std::cout << "result " << smallest + largest << '\n';
+        const auto range = find_sum_range(numbers, *invalid_number);
+        if(!range)
+        {
+            std::cout << "No contiguous numbers add up to " << *invalid_number << '\n';
+            continue;
+        }
+
+        std::cout << "smallest " << range->smallest << ", largest " << range->largest << '\n';
+        std::cout << "result " << range->smallest + range->largest << '\n';
+    }
 
 
     return 0;
-}
+}
\ No newline at end of file